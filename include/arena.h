@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+/* Bump allocator. Everything allocated from it is released at once by arenaReset, which keeps the blocks for reuse */
+typedef struct {
+    ArenaBlock *head;
+    ArenaBlock *cur;
+} Arena;
+
+void arenaInit(Arena *a);
+void *arenaAlloc(Arena *a, size_t size);
+char *arenaStrdup(Arena *a, const char *s);
+char *arenaStrndup(Arena *a, const char *s, size_t len);
+void arenaReset(Arena *a);
+void arenaFree(Arena *a);
+#endif
@@ -0,0 +1,61 @@
+#ifndef BANKING_H
+#define BANKING_H
+#include <stddef.h>
+#include <stdint.h>
+#include "status.h"
+#include "hashmap.h"
+#include "instruction.h"
+#include "token_list.h"
+
+#define MAX_SECTIONS 256
+#define DEFAULT_BANK_PORT 0xFF
+#define DEFAULT_BANK_REG 15
+
+/* Cross-bank transfers go through trampolines placed at the same address in every bank (the common area),
+   so the bank switch done by OUTPUTP takes effect while executing identical code:
+    call:  LOAD %reg, <dst bank> ; OUTPUTP %reg, <port> ; CALL <target> ; LOAD %reg, <src bank> ; OUTPUTP %reg, <port> ; RET
+    jump:  LOAD %reg, <dst bank> ; OUTPUTP %reg, <port> ; JMP <target>
+*/
+#define CALL_TRAMPOLINE_SIZE 6
+#define JUMP_TRAMPOLINE_SIZE 3
+/* Instructions executed on top of a direct CALL/RET or JMP */
+#define CALL_TRAMPOLINE_OVERHEAD 5
+#define JUMP_TRAMPOLINE_OVERHEAD 3
+
+/* A label named in the linker script starts a section, which runs until the next named label */
+typedef struct {
+    char *label;
+    uint8_t bank;
+} BankPlacement;
+
+typedef struct {
+    uint8_t port;
+    uint8_t reg;
+    uint16_t placement_count;
+    BankPlacement placements[MAX_SECTIONS];
+} LinkerScript;
+
+typedef struct {
+    Instruction image[ROM_SIZE + 1]; /* Terminated by an empty instruction, as expected by writeInstructionsToFile */
+    uint16_t code_size;              /* Program words, fall-through jumps included */
+    uint16_t size;                   /* Words in the image, padding and common area included */
+} Bank;
+
+typedef struct {
+    Bank banks[MAX_BANKS];
+    uint8_t bank_count;
+    uint16_t common_base; /* First address of the common area */
+    uint16_t common_size;
+    uint16_t call_trampolines;
+    uint16_t jump_trampolines;
+    uint16_t cross_refs;
+    uint16_t fallthrough_jumps;
+    uint16_t interrupt_size; /* Leading section holding the interrupt handler, copied to address 0 of every bank */
+} BankedProgram;
+
+Status readLinkerScript(LinkerScript *ls, const char *f_name, DiagSink *sink);
+void deallocLinkerScript(LinkerScript *ls);
+Status bankProgram(BankedProgram *bp, const LinkerScript *ls, TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t instr_count);
+void makeBankFileName(char *buf, size_t buf_size, const char *path, uint8_t bank);
+void printBankReport(const BankedProgram *bp);
+#endif
@@ -0,0 +1,59 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "status.h"
+
+/* Output line templates, text with fields replaced for every instruction:
+    {addr}          Instruction address, decimal
+    {word}          Encoded instruction, 4 hex digits
+    {field:spec}    spec = [0][width]conv[group], conv is one of d (decimal), x / X (hex) or b (binary, width in bits)
+                    group splits binary digits into space separated groups, e.g. {word:b4} -> 1100 0001 1101 0100
+    {every:N:text}  Emits text before the line on every Nth instruction, starting with the first
+    {{ }} \n \t \\  Literal braces, newline, tab and backslash
+   A newline is appended when the template does not end with one
+*/
+#define FORMAT_DEBUG "{every:10:       FEDC BA98 7654 3210\\n}{addr:03d} => {word:b4}\\n"
+#define FORMAT_VHDL_BIN " \"{addr}\" => b\"{word:b}\",\\n"
+#define FORMAT_VHDL_HEX " \"{addr}\" => x\"{word:04X}\",\\n"
+
+#define MAX_FORMAT_OPS 32
+#define MAX_FORMAT_TEXT 256
+
+typedef enum {
+    FMT_TEXT,
+    FMT_EVERY, /* Text emitted on every Nth instruction */
+    FMT_DEC,
+    FMT_HEX,
+    FMT_BIN
+} FormatOpKind;
+
+typedef enum {
+    FIELD_ADDR,
+    FIELD_WORD
+} FormatField;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t field;
+    uint8_t width;
+    uint8_t group;     /* Binary digits per group, 0 for none */
+    char pad;          /* '0' or ' ' */
+    uint8_t lowercase; /* Hex digits */
+    uint16_t every;
+    uint16_t text_off; /* Literal text inside FormatTemplate.text */
+    uint16_t text_len;
+} FormatOp;
+
+/* A template compiled once into a flat list of emit operations */
+typedef struct {
+    FormatOp ops[MAX_FORMAT_OPS];
+    uint16_t op_count;
+    uint16_t text_len;
+    size_t max_line; /* Upper bound of the rendered length of one instruction */
+    char text[MAX_FORMAT_TEXT];
+} FormatTemplate;
+
+Status compileTemplate(FormatTemplate *t, const char *src);
+size_t renderTemplate(const FormatTemplate *t, char *out, uint16_t addr, uint16_t word);
+#endif
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+/* Initial slot count, maps double whenever they get more than half full */
 #define HASH_MAP_BUCKETS 512
 #define FNV_OFFSET 2166136261
 #define FNV_PRIME 16777619
@@ -21,7 +22,10 @@ typedef struct {
 } HashMap;
 
 bool allocHashMap(HashMap **map, const size_t slot_count);
+bool growHashMap(HashMap *t);
 bool insertHashMap(HashMap *t, const char *key, const void *value, size_t value_size);
+bool removeHashMap(HashMap *t, const char *key);
+void clearHashMap(HashMap *t);
 void deallocHashMap(HashMap *t);
 void *getPointerInHashMap(HashMap *t, const char *key);
 
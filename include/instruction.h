@@ -2,12 +2,19 @@
 #define INSTRUCTION_H
 #include <stdint.h>
 #include "token_list.h"
+
+/* One ROM bank holds 256 words, since ADDR operands are encoded on 8 bits */
+#define ROM_SIZE 256
+#define MAX_BANKS 16
+#define MAX_PROGRAM_SIZE (ROM_SIZE * MAX_BANKS)
+
 typedef enum { NO_ARG,
                REG,
                ADDR,
                REG_REG,
                REG_IMM,
-               REG_ANY
+               REG_ANY,
+               DATA /* Word placed by DW / INCBIN, raw is already encoded */
 } ArgumentType;
 
 typedef struct {
@@ -1,21 +1,41 @@
 
 #ifndef IO_H
 #define IO_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include "token_list.h"
 #include "instruction.h"
 #include "status.h"
+#include "format.h"
 
-typedef void (*FormatterFn)(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr);
+/* Lines longer than this are lexed as several lines */
+#define LEX_LINE_SIZE 255
+/* Files are split into chunks of at least this size to be lexed in parallel */
+#define LEX_MIN_CHUNK_SIZE (16 * 1024)
+#define MAX_LEX_THREADS 16
 
-const char *getProgramName(const char *path);
+/* Read-only view of a whole file, memory mapped where the platform allows it */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+} MappedFile;
+
+typedef enum {
+    WRITE_ALWAYS,
+    WRITE_IF_CHANGED /* Leave an identical file untouched, so its modification time does not change */
+} WriteMode;
 
-Status readTokensFromFile(TokenList *tl, const char *f_name);
-Status writeInstructionsToFile(Instruction *instr_list, const char *f_name, FormatterFn formatter);
+const char *getProgramName(const char *path);
+unsigned getCpuCount(void);
 
-void VHDL_STYLE_HEX(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr);
-void VHDL_STYLE_BIN(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr);
-void DEBUG(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr);
+Status readTokensFromFile(TokenList *tl, const char *f_name, DiagSink *sink, unsigned thread_count);
+Status readTokensFromBuffer(TokenList *tl, const char *data, size_t size, const char *name, DiagSink *sink, unsigned thread_count);
+Status mapFile(MappedFile *mf, const char *f_name);
+void unmapFile(MappedFile *mf);
+Status writeFileAtomic(const char *f_name, const void *data, size_t size, WriteMode mode);
+size_t renderInstructions(const Instruction *instr_list, size_t count, const FormatTemplate *format, char *out);
+Status writeInstructionsToFile(Instruction *instr_list, const char *f_name, const FormatTemplate *format, WriteMode mode);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,10 @@
 
 #ifndef LEXER_H
 #define LEXER_H
+#include <stdbool.h>
 #include "token_list.h"
 #include "status.h"
-Status classifyToken(TokenList *tl, const char *tkn, const uint8_t line_number, const uint8_t col_number);
+bool isDirective(const char *tkn);
+Status classifyDirective(TokenList *tl, const char *tkn, char *operands, const uint32_t line_number, const uint8_t col_number);
+Status classifyToken(TokenList *tl, const char *tkn, const uint32_t line_number, const uint8_t col_number);
 #endif
\ No newline at end of file
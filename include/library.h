@@ -0,0 +1,52 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "status.h"
+#include "hashmap.h"
+#include "instruction.h"
+#include "token_list.h"
+#include "io.h"
+
+#define MAX_LIBRARIES 16
+/* Reason recorded for routines kept without being referenced by another routine */
+#define REACHED_BY_PROGRAM 0xFFFF
+#define REACHED_BY_INTERRUPT 0xFFFE
+#define NO_INTERRUPT_VECTOR 0xFFFF
+
+/* Routine library given with -l, placed after the program and stripped down to the routines it uses */
+typedef struct {
+    const char *path;
+    TokenList tl; /* Kept alive as long as the instructions pointing into it */
+    uint16_t start;
+    uint16_t end;
+} Library;
+
+/* Strippable unit of a library: a label and the instructions up to the next label */
+typedef struct {
+    const char *name; /* First label of the unit, NULL for code before the first label of a library */
+    uint16_t library;
+    uint16_t start; /* Location before stripping */
+    uint16_t size;
+    bool kept;
+    uint16_t reached_by; /* Routine referencing it or falling into it, or one of the REACHED_BY values */
+} LibraryRoutine;
+
+typedef struct {
+    Library libraries[MAX_LIBRARIES];
+    uint16_t library_count;
+    LibraryRoutine *routines;
+    uint16_t routine_count;
+    uint16_t program_size; /* Instructions of the program itself, always kept */
+    uint16_t interrupt_vector; /* Address the hardware enters on an interrupt (-I), NO_INTERRUPT_VECTOR when not given */
+    uint16_t words_before;
+    uint16_t words_after;
+} LibrarySet;
+
+void initLibrarySet(LibrarySet *ls);
+Status loadLibrary(LibrarySet *ls, const char *path, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count, DiagSink *sink, unsigned thread_count);
+Status stripLibraries(LibrarySet *ls, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count);
+Status writeLibraryMap(const LibrarySet *ls, const char *f_name, WriteMode mode);
+void printLibraryReport(const LibrarySet *ls);
+void deallocLibrarySet(LibrarySet *ls);
+#endif
@@ -3,5 +3,6 @@
 #include "status.h"
 #include "instruction.h"
 #include "hashmap.h"
-Status link(Instruction *instr_list, uint8_t instr_count, HashMap *sym_map);
+Status encodeInstruction(Instruction *instr, uint16_t idx, HashMap *sym_map);
+Status link(Instruction *instr_list, uint16_t instr_count, HashMap *sym_map, DiagSink *sink);
 #endif
\ No newline at end of file
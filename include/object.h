@@ -0,0 +1,53 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+#include <stdint.h>
+#include "status.h"
+#include "hashmap.h"
+#include "instruction.h"
+#include "token_list.h"
+#include "io.h"
+
+/* Relocatable object file, written with -c and combined by the link step.
+   All sections are fixed size records stored in host byte order and naturally aligned,
+   so a mapped object is used in place without any parsing:
+    ObjHeader | uint16_t words[word_count] (padded to 4 bytes) | ObjSymbol[symbol_count] | ObjReloc[reloc_count] | string table
+*/
+#define OBJ_MAGIC "PICO"
+#define OBJ_VERSION 1
+
+#define OBJ_SYM_EXPORTED 0x01
+
+typedef enum {
+    RELOC_LOCAL = 0, /* Address of a label of the same object, shifted by the object base */
+    RELOC_EXTERN     /* Address of a symbol exported by another object */
+} RelocKind;
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t word_count;
+    uint16_t symbol_count;
+    uint16_t reloc_count;
+    uint32_t strtab_size;
+} ObjHeader;
+
+typedef struct {
+    uint32_t name; /* Offset inside the string table */
+    uint16_t value;
+    uint8_t flags;
+    uint8_t reserved;
+} ObjSymbol;
+
+/* The address field of a relocated word is left empty and filled in by the link step */
+typedef struct {
+    uint32_t name; /* Referenced symbol for RELOC_EXTERN */
+    uint16_t word; /* Index of the patched word */
+    uint8_t kind;
+    uint8_t shift;   /* Position of the address field inside the word */
+    uint16_t addend; /* Label address inside the object for RELOC_LOCAL */
+    uint16_t reserved;
+} ObjReloc;
+
+Status writeObjectFile(Instruction *instr_list, uint16_t instr_count, TokenList *tl, HashMap *sym_map, const char *f_name, WriteMode mode);
+Status linkObjectFiles(Instruction *instr_list, uint16_t *instr_count, const char **paths, int path_count, DiagSink *sink);
+#endif
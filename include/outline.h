@@ -0,0 +1,33 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+#include <stdint.h>
+#include "status.h"
+#include "hashmap.h"
+#include "instruction.h"
+#include "token_list.h"
+
+/* Longest sequence considered for outlining and most routines created by a single run */
+#define OUTLINE_MAX_LENGTH 32
+#define MAX_OUTLINED 64
+/* Instructions executed on top of the outlined sequence every time a call site runs: its CALL and the routine's RET */
+#define OUTLINE_SITE_OVERHEAD 2
+
+/* A repeated sequence moved into a subroutine, every occurrence became a CALL to it */
+typedef struct {
+    const char *label; /* Synthetic symbol of the routine, owned by the token list */
+    uint16_t addr;
+    uint16_t length; /* Outlined instructions, the RET excluded */
+    uint16_t sites;
+} OutlinedRoutine;
+
+typedef struct {
+    OutlinedRoutine routines[MAX_OUTLINED];
+    uint16_t routine_count;
+    uint16_t words_before;
+    uint16_t words_after;
+    const char *skipped; /* Why the program was left as is, NULL when the pass ran */
+} OutlineReport;
+
+Status outlineProgram(OutlineReport *report, TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count);
+void printOutlineReport(const OutlineReport *report);
+#endif
@@ -6,5 +6,5 @@
 #include "sll.h"
 #include "instruction.h"
 Status consumeArgs(HashMap *instr_list, InstructionDefinition *def, SllNode *mnemonic_node, SllNode **next, Instruction *out);
-Status parseTokenList(TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *loc_count);
+Status parseTokenList(TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *loc_count, DiagSink *sink);
 #endif
\ No newline at end of file
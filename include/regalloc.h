@@ -0,0 +1,26 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+#include <stdint.h>
+#include "status.h"
+#include "hashmap.h"
+#include "instruction.h"
+
+#define PHYSICAL_REGS 16
+#define MAX_VIRTUAL_REGS 256
+
+/* Physical register chosen for a virtual register '%v.<name>' */
+typedef struct {
+    const char *name; /* Name of the first token using it, owned by the token list */
+    uint8_t reg;
+} RegMapping;
+
+typedef struct {
+    RegMapping mappings[MAX_VIRTUAL_REGS]; /* In order of first use */
+    uint16_t virtual_count;
+    uint16_t copies_removed;
+    uint16_t max_live; /* Most values live at once, physical registers included */
+} RegAllocReport;
+
+Status allocateRegisters(RegAllocReport *report, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count, uint16_t reserved, DiagSink *sink);
+void printRegAllocReport(const RegAllocReport *report);
+#endif
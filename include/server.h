@@ -0,0 +1,20 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include "hashmap.h"
+
+/* Resident mode: one JSON request per line, answered with one JSON line each
+    {"id": 1, "source": "LOAD %1, !d1\n...", "formats": ["vhdlhex", "{addr}: {word:04X}"]}
+    {"id": 2, "path": "prog.txt"}
+   formats holds built-in format names or output templates (debug when omitted). The answer echoes the id:
+    {"id": 1, "ok": true, "words": 2, "outputs": {"vhdlhex": "..."}, "diagnostics": []}
+    {"id": 2, "ok": false, "words": 0, "outputs": {}, "diagnostics": [{"tag": "PARSE", "code": 9, "line": 3, "col": 2, "message": "..."}]}
+   Requests are read from stdin, or from the connections of a Unix socket when a path is given,
+   and handled one by one by a pool of workers, whichever client they come from. Answers are written in completion
+   order, match them by id
+*/
+#define SERVE_MAX_REQUEST_SIZE (16 * 1024 * 1024)
+#define SERVE_MAX_FORMATS 8
+#define SERVE_QUEUE_SIZE 64
+
+int runServer(const char *socket_path, unsigned worker_count, HashMap *inst_map);
+#endif
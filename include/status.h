@@ -1,8 +1,15 @@
 #ifndef STATUS_H
 #define STATUS_H
+#include <stddef.h>
 #include <stdint.h>
 
-#define NO_POS 0xFF
+#define NO_POS UINT32_MAX
+/* Most arguments taken by a diagnostic message, a '*' width or precision counts as one. Extra conversions are printed as '?' */
+#define STATUS_MAX_ARGS 4
+/* Room for the copies of the string arguments and of the instruction prefix of a status */
+#define STATUS_TEXT_SIZE 96
+/* Part of it kept for the instruction prefix, set after the arguments */
+#define STATUS_AT_ROOM 16
 
 typedef enum {
     OK = 0,
@@ -12,11 +19,14 @@ typedef enum {
     ERR_LEX_REG_BOUNDS,
     ERR_LEX_IMM_BOUNDS,
     ERR_LEX_INVALID_IMM_FORMAT,
+    ERR_LEX_DIRECTIVE,
 
     ERR_PARSE_ARG_COUNT,
     ERR_PARSE_ARG_TYPE,
     ERR_PARSE_INTERNAL,
     ERR_PARSE_DUP_SYMBOL,
+    ERR_PARSE_SYMBOL_TABLE,
+    ERR_PARSE_DATA,
 
     ERR_IO_INVALID_FILE,
     ERR_IO_FAIL_OPEN_FILE,
@@ -25,16 +35,75 @@ typedef enum {
     ERR_LINK_SYMBOL_UNDEFINED,
     ERR_LINK_UNKNOWN_ARG_TYPE,
     ERR_LINK_MISSING_INSTRUCTION,
+    ERR_LINK_ADDR_RANGE,
+
+    ERR_BANK_SCRIPT,
+    ERR_BANK_OVERFLOW,
+    ERR_BANK_INTERNAL,
+
+    ERR_OBJ_FORMAT,
+    ERR_OBJ_DUP_SYMBOL,
+
+    ERR_FORMAT_TEMPLATE,
+
+    ERR_SERVE_REQUEST,
+
+    ERR_OUTLINE_INTERNAL,
+
+    ERR_ALLOC_PRESSURE,
+    ERR_ALLOC_INTERNAL,
+
+    ERR_LIB_INTERNAL,
 
 } StatusCode;
 
+typedef union {
+    unsigned str; /* 1 + offset of the copied string in Status.text, 0 for NULL */
+    long long num;
+    unsigned long long unum;
+    double real;
+    const void *ptr;
+} StatusArg;
+
+/* A status only records the message format and its arguments, the text is built when it is printed.
+    '%s' arguments are copied into the status, so it stays valid once the buffers they pointed into are released.
+    Strings not fitting the room left in text are cut and end in "..."
+*/
 typedef struct {
     StatusCode code;
-    uint8_t line;
-    uint8_t col;
-    char message[128];
+    uint32_t line;
+    uint32_t col;
+    uint8_t at; /* Reference in text of the instruction the error was found in, printed as a prefix, 0 when none */
+    uint8_t text_len;
+    const char *fmt;
+    StatusArg args[STATUS_MAX_ARGS];
+    char text[STATUS_TEXT_SIZE];
 } Status;
 
-Status makeStatus(StatusCode code, uint8_t line, uint8_t col, const char *fmt, ...);
+/* Collects the diagnostics of a run so all of them are reported instead of only the first one */
+typedef struct {
+    Status *items;
+    const char **tags;
+    size_t count;
+    size_t capacity;
+} DiagSink;
+
+/* Lets the compiler check makeStatus formats. Every printf conversion is recorded except %n and wide characters / strings */
+#if defined(__GNUC__) || defined(__clang__)
+#define STATUS_FORMAT(fmt_idx, first_arg) __attribute__((format(printf, fmt_idx, first_arg)))
+#else
+#define STATUS_FORMAT(fmt_idx, first_arg)
+#endif
+
+Status makeStatus(StatusCode code, uint32_t line, uint32_t col, const char *fmt, ...) STATUS_FORMAT(4, 5);
+void setStatusAt(Status *s, const char *at);
+size_t formatStatus(const Status *s, char *buf, size_t buf_size);
 void printStatus(const Status *s, const char *tag);
+
+void diagInit(DiagSink *sink);
+void diagReport(DiagSink *sink, const Status *s, const char *tag);
+void diagMerge(DiagSink *dst, DiagSink *src);
+void diagPrintAll(const DiagSink *sink);
+void diagFlush(DiagSink *sink);
+void diagFree(DiagSink *sink);
 #endif
\ No newline at end of file
@@ -4,13 +4,24 @@
 typedef enum { TOK_LABEL,
                TOK_MNEMONIC,
                TOK_REGISTER,
-               TOK_NUMBER } TokenType;
+               TOK_NUMBER,
+               TOK_DIRECTIVE } TokenType;
+
+/* Token.value flag of labels defined with '##', visible to other objects when assembled with -c */
+#define LABEL_EXPORTED 0x01
+
+/* Token.value flag of virtual registers '%v.<name>', replaced by a physical index when registers are allocated */
+#define REGISTER_VIRTUAL 0x80
+
+/* Token.value of directives, their operands are kept as text in Token.name and decoded by the parser */
+#define DIRECTIVE_DW 0
+#define DIRECTIVE_INCBIN 1
 
 typedef struct {
     const char *name;
     TokenType type;
     uint8_t value;
-    uint8_t line;
+    uint32_t line;
     uint8_t col;
 } Token;
 
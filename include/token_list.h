@@ -2,16 +2,21 @@
 #define TOKEN_LIST_H
 #include "token.h"
 #include "sll.h"
+#include "arena.h"
 typedef struct {
     SllNode link;
     Token tok;
 } TokenNode;
 
+/* Nodes and names come from the arena when one is set, they are then released with it instead of by deallocTokenList */
 typedef struct {
     Sll list;
+    Arena *arena;
 } TokenList;
 
 void tokenListInit(TokenList *tl);
+void tokenListInitArena(TokenList *tl, Arena *arena);
+const char *tokenListDup(TokenList *tl, const char *name);
 void tokenListPushBack(TokenList *tl, Token tok);
 void printAllTokens(TokenList *tl);
 void deallocTokenList(TokenList *tl);
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN(n) (((n) + 15u) & ~(size_t)15u)
+#define BLOCK_DATA(b) ((char *)(b) + ARENA_ALIGN(sizeof(ArenaBlock)))
+
+void arenaInit(Arena *a) {
+    a->head = a->cur = NULL;
+}
+
+/* Allocations are 16 byte aligned. Blocks kept from a previous use are filled again before new ones are added */
+void *arenaAlloc(Arena *a, size_t size) {
+    size = ARENA_ALIGN(size ? size : 1);
+    while (a->cur && a->cur->used + size > a->cur->size) {
+        a->cur = a->cur->next;
+        if (a->cur) {
+            a->cur->used = 0;
+        }
+    }
+    if (!a->cur) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *b = (ArenaBlock *)malloc(ARENA_ALIGN(sizeof(ArenaBlock)) + block_size);
+        if (!b) {
+            return NULL;
+        }
+        *b = (ArenaBlock){.next = NULL, .size = block_size, .used = 0};
+        /* Appended at the end, so the blocks before it are not skipped on the next use */
+        ArenaBlock **tail = &a->head;
+        while (*tail) {
+            tail = &(*tail)->next;
+        }
+        *tail = b;
+        a->cur = b;
+    }
+    void *p = BLOCK_DATA(a->cur) + a->cur->used;
+    a->cur->used += size;
+    return p;
+}
+
+char *arenaStrndup(Arena *a, const char *s, size_t len) {
+    char *p = (char *)arenaAlloc(a, len + 1);
+    if (p) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+char *arenaStrdup(Arena *a, const char *s) {
+    return arenaStrndup(a, s, strlen(s));
+}
+
+void arenaReset(Arena *a) {
+    a->cur = a->head;
+    if (a->cur) {
+        a->cur->used = 0;
+    }
+}
+
+void arenaFree(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = a->cur = NULL;
+}
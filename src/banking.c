@@ -0,0 +1,573 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "banking.h"
+#include "io.h"
+#include "linker.h"
+
+#define MAX_TRAMPOLINES (ROM_SIZE / JUMP_TRAMPOLINE_SIZE + 1)
+
+/* Contiguous run of the flat program which is moved as a whole into one bank */
+typedef struct {
+    const char *label; /* Label named in the linker script, NULL for the code preceding the first one */
+    uint16_t start;    /* Flat program range [start, end) */
+    uint16_t end;
+    uint16_t addr; /* Address of the first instruction inside its bank */
+    uint8_t bank;
+    bool fallthrough; /* The next section lives in another bank, so a jump to it is appended */
+} Section;
+
+typedef struct {
+    const char *label;
+    TokenNode *tok; /* Symbol used by the callers, resolves to the trampoline address */
+    uint16_t offset; /* Offset inside the common area */
+    uint8_t src_bank;
+    uint8_t dst_bank;
+    bool is_call;
+} Trampoline;
+
+typedef struct {
+    BankedProgram *bp;
+    const LinkerScript *ls;
+    TokenList *tl;
+    HashMap *sym_map;
+    HashMap *tramp_map;
+
+    Section sections[MAX_SECTIONS + 1];
+    uint16_t section_count;
+    Trampoline trampolines[MAX_TRAMPOLINES];
+    uint16_t trampoline_count;
+
+    /* Instructions emitted by the banking pass */
+    InstructionDefinition *load_def;
+    InstructionDefinition *outputp_def;
+    InstructionDefinition *jmp_def;
+    InstructionDefinition *ret_def;
+    InstructionDefinition *call_defs[5];
+    /* Instructions after which execution never falls through */
+    InstructionDefinition *barrier_defs[4];
+    bool replicate_leading; /* The leading section holds the interrupt handler and is copied into every bank */
+
+    TokenNode *reg_tok;
+    TokenNode *port_tok;
+    TokenNode *bank_toks[MAX_BANKS];
+} BankingContext;
+
+/* Unused words between the code and the common area, never executed */
+static InstructionDefinition pad_def = {.mask = 0, .arg_type = NO_ARG};
+
+/* Parse an unsigned decimal number bounded by max */
+bool parseScriptNumber(const char *p, unsigned long max, unsigned long *out) {
+    if (!p || *p < '0' || *p > '9') {
+        return false;
+    }
+    char *end = NULL;
+    unsigned long value = strtoul(p, &end, 10);
+    if (*end != '\0' || value > max) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+/* Process a single linker script line. Supported directives:
+    PORT <0-255>             Output port which selects the active bank
+    REG <0-15>               Scratch register clobbered by the trampolines
+    BANK <n> <label> [...]   Place the sections starting at the given labels into bank n
+*/
+Status processScriptLine(LinkerScript *ls, char *line, uint32_t line_number) {
+    char *rest = line;
+    char *directive = strtok_r(rest, " ,\t\r\n", &rest);
+    if (!directive || directive[0] == ';') {
+        return (Status){.code = OK};
+    }
+    char *arg = strtok_r(rest, " ,\t\r\n", &rest);
+    unsigned long value = 0;
+
+    if (!strcmp(directive, "PORT")) {
+        if (!parseScriptNumber(arg, UINT8_MAX, &value)) {
+            return makeStatus(ERR_BANK_SCRIPT, line_number, 2, "Bad PORT '%s'. Expected a decimal port number in [0 - 255]", arg ? arg : "");
+        }
+        ls->port = (uint8_t)value;
+    } else if (!strcmp(directive, "REG")) {
+        if (!parseScriptNumber(arg, 15, &value)) {
+            return makeStatus(ERR_BANK_SCRIPT, line_number, 2, "Bad REG '%s'. Expected a decimal register index in [0 - 15]", arg ? arg : "");
+        }
+        ls->reg = (uint8_t)value;
+    } else if (!strcmp(directive, "BANK")) {
+        if (!parseScriptNumber(arg, MAX_BANKS - 1, &value)) {
+            return makeStatus(ERR_BANK_SCRIPT, line_number, 2, "Bad BANK '%s'. Expected a decimal bank index in [0 - %u]", arg ? arg : "", MAX_BANKS - 1);
+        }
+        uint8_t col_number = 3;
+        while ((arg = strtok_r(rest, " ,\t\r\n", &rest)) && arg[0] != ';') {
+            if (ls->placement_count >= MAX_SECTIONS) {
+                return makeStatus(ERR_BANK_SCRIPT, line_number, col_number, "Too many placed labels, maximum is %u", MAX_SECTIONS);
+            }
+            char *label = strdup(arg);
+            if (!label) {
+                return makeStatus(ERR_BANK_INTERNAL, line_number, col_number, "Error allocating the placed label '%s'", arg);
+            }
+            ls->placements[ls->placement_count++] = (BankPlacement){.label = label, .bank = (uint8_t)value};
+            col_number++;
+        }
+        return (Status){.code = OK};
+    } else {
+        return makeStatus(ERR_BANK_SCRIPT, line_number, 1, "Unknown linker script directive '%s'. Use PORT, REG or BANK", directive);
+    }
+
+    arg = strtok_r(rest, " ,\t\r\n", &rest);
+    if (arg && arg[0] != ';') {
+        return makeStatus(ERR_BANK_SCRIPT, line_number, 3, "Unexpected argument '%s' after %s", arg, directive);
+    }
+    return (Status){.code = OK};
+}
+
+/* Read the linker script describing how the program is split into banks, bad lines are reported to the sink */
+Status readLinkerScript(LinkerScript *ls, const char *f_name, DiagSink *sink) {
+    memset(ls, 0, sizeof(*ls));
+    ls->port = DEFAULT_BANK_PORT;
+    ls->reg = DEFAULT_BANK_REG;
+
+    FILE *fp = fopen(f_name, "r");
+    if (!fp) {
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not open linker script: %s", f_name);
+    }
+    uint32_t line_number = 1;
+    StatusCode first_error = OK;
+    unsigned error_count = 0;
+    char line[255];
+    while (fgets(line, sizeof(line), fp)) {
+        Status line_ok = processScriptLine(ls, line, line_number);
+        if (line_ok.code != OK) {
+            diagReport(sink, &line_ok, "LINKER SCRIPT");
+            first_error = error_count++ ? first_error : line_ok.code;
+        }
+        line_number++;
+    }
+    fclose(fp);
+    if (error_count) {
+        return makeStatus(first_error, NO_POS, NO_POS, "%u error(s) in linker script '%s'", error_count, f_name);
+    }
+    return (Status){.code = OK};
+}
+
+void deallocLinkerScript(LinkerScript *ls) {
+    for (uint16_t i = 0; i < ls->placement_count; i++) {
+        free(ls->placements[i].label);
+    }
+    ls->placement_count = 0;
+}
+
+/* Build a file name for the image of a bank: out.txt -> out.bank1.txt */
+void makeBankFileName(char *buf, size_t buf_size, const char *path, uint8_t bank) {
+    const char *name = getProgramName(path);
+    const char *ext = strrchr(name, '.');
+    if (!ext || ext == name) {
+        snprintf(buf, buf_size, "%s.bank%u", path, bank);
+    } else {
+        snprintf(buf, buf_size, "%.*s.bank%u%s", (int)(ext - path), path, bank, ext);
+    }
+}
+
+/* Tokens created by the banking pass are owned by the token list, so they are released with it */
+TokenNode *pushSyntheticToken(TokenList *tl, const char *name, TokenType type, uint8_t value) {
+    tokenListPushBack(tl, (Token){.name = tokenListDup(tl, name), .type = type, .value = value, .line = 0, .col = 0});
+    return CONTAINER_OF(tl->list.tail, TokenNode, link);
+}
+
+bool isDefinitionIn(InstructionDefinition *def, InstructionDefinition **defs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (defs[i] == def) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Find the section holding a flat location, a label sitting on a section boundary belongs to the following section */
+Section *sectionOf(BankingContext *ctx, uint16_t loc) {
+    Section *s = &ctx->sections[0];
+    for (uint16_t i = 1; i < ctx->section_count && ctx->sections[i].start <= loc; i++) {
+        s = &ctx->sections[i];
+    }
+    return s;
+}
+
+Status lookupBankingDefinitions(BankingContext *ctx, HashMap *inst_map) {
+    static const char *call_names[] = {"CALL", "CALLZ", "CALLNZ", "CALLC", "CALLNC"};
+    static const char *barrier_names[] = {"JMP", "RET", "RETE", "RETD"};
+
+    ctx->load_def = getPointerInHashMap(inst_map, "LOAD");
+    ctx->outputp_def = getPointerInHashMap(inst_map, "OUTPUTP");
+    ctx->jmp_def = getPointerInHashMap(inst_map, "JMP");
+    ctx->ret_def = getPointerInHashMap(inst_map, "RET");
+    bool found = ctx->load_def && ctx->outputp_def && ctx->jmp_def && ctx->ret_def;
+    for (size_t i = 0; i < 5; i++) {
+        ctx->call_defs[i] = getPointerInHashMap(inst_map, call_names[i]);
+        found = found && ctx->call_defs[i];
+    }
+    for (size_t i = 0; i < 4; i++) {
+        ctx->barrier_defs[i] = getPointerInHashMap(inst_map, barrier_names[i]);
+        found = found && ctx->barrier_defs[i];
+    }
+    if (!found) {
+        return makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Instruction set is missing the instructions used by the bank trampolines");
+    }
+    return (Status){.code = OK};
+}
+
+/* Split the flat program into sections, ordered by their location in the source */
+Status buildSections(BankingContext *ctx, uint16_t instr_count) {
+    ctx->sections[0] = (Section){.label = NULL, .start = 0, .bank = 0};
+    ctx->section_count = 1;
+
+    for (uint16_t p = 0; p < ctx->ls->placement_count; p++) {
+        const BankPlacement *placement = &ctx->ls->placements[p];
+        uint16_t *loc = getPointerInHashMap(ctx->sym_map, placement->label);
+        if (!loc) {
+            return makeStatus(ERR_BANK_SCRIPT, NO_POS, NO_POS, "Label '%s' placed in bank %u is not defined in the program", placement->label, placement->bank);
+        }
+        uint16_t idx = 0;
+        while (idx < ctx->section_count && ctx->sections[idx].start < *loc) {
+            idx++;
+        }
+        if (idx < ctx->section_count && ctx->sections[idx].start == *loc) {
+            Section *same = &ctx->sections[idx];
+            if (!same->label) { /* The label starts the program, it takes over the leading section */
+                same->label = placement->label;
+                same->bank = placement->bank;
+            } else if (same->bank != placement->bank) {
+                return makeStatus(ERR_BANK_SCRIPT, NO_POS, NO_POS, "Labels '%s' and '%s' start the same section but are placed in banks %u and %u", same->label, placement->label, same->bank, placement->bank);
+            }
+            continue;
+        }
+        memmove(&ctx->sections[idx + 1], &ctx->sections[idx], (ctx->section_count - idx) * sizeof(Section));
+        ctx->sections[idx] = (Section){.label = placement->label, .start = *loc, .bank = placement->bank};
+        ctx->section_count++;
+    }
+
+    for (uint16_t i = 0; i < ctx->section_count; i++) {
+        ctx->sections[i].end = (i + 1 < ctx->section_count) ? ctx->sections[i + 1].start : instr_count;
+        if (ctx->sections[i].bank >= ctx->bp->bank_count) {
+            ctx->bp->bank_count = ctx->sections[i].bank + 1;
+        }
+    }
+    if (ctx->sections[0].bank != 0) {
+        return makeStatus(ERR_BANK_SCRIPT, NO_POS, NO_POS, "Program entry must stay in bank 0, label '%s' places it in bank %u", ctx->sections[0].label, ctx->sections[0].bank);
+    }
+    return (Status){.code = OK};
+}
+
+/* An interrupt can arrive whatever bank is selected, so the vector and the handler must be at the same address in every
+    bank. Programs returning from interrupts (RETE / RETD) and spread over several banks keep the handler in the leading
+    section, which is copied to address 0 of every bank; its code branching elsewhere goes through the trampolines of
+    the bank the copy sits in. The leading section must not run into the next one, a copy would run into another bank
+*/
+Status checkInterruptLayout(BankingContext *ctx, Instruction *instr_list) {
+    if (ctx->bp->bank_count < 2) {
+        return (Status){.code = OK};
+    }
+    const Section *lead = &ctx->sections[0];
+    for (uint16_t i = 0; i < ctx->sections[ctx->section_count - 1].end; i++) {
+        InstructionDefinition *def = instr_list[i].instruction;
+        if (def != ctx->barrier_defs[2] && def != ctx->barrier_defs[3]) {
+            continue;
+        }
+        if (i >= lead->end) {
+            const Section *s = sectionOf(ctx, i);
+            return makeStatus(ERR_BANK_SCRIPT, NO_POS, NO_POS, "Interrupt return in section '%s' at %u. Interrupt handlers must stay in the code before the first placed label, which is copied into every bank", s->label, i);
+        }
+        ctx->replicate_leading = true;
+    }
+    if (ctx->replicate_leading && (lead->end == lead->start || !isDefinitionIn(instr_list[lead->end - 1].instruction, ctx->barrier_defs, 4))) {
+        return makeStatus(ERR_BANK_SCRIPT, NO_POS, NO_POS, "The code before the first placed label holds the interrupt handler and is copied into every bank, it must end with JMP, RET, RETE or RETD");
+    }
+    return (Status){.code = OK};
+}
+
+/* Assign bank addresses to the sections, keeping the source order inside every bank */
+Status placeSections(BankingContext *ctx, Instruction *instr_list) {
+    uint16_t fill[MAX_BANKS] = {0};
+    if (ctx->replicate_leading) {
+        ctx->bp->interrupt_size = ctx->sections[0].end - ctx->sections[0].start;
+        for (uint8_t b = 1; b < ctx->bp->bank_count; b++) {
+            fill[b] = ctx->bp->interrupt_size;
+        }
+    }
+    for (uint16_t i = 0; i < ctx->section_count; i++) {
+        Section *s = &ctx->sections[i];
+        s->addr = fill[s->bank];
+        fill[s->bank] += s->end - s->start;
+        /* Code running off the end of the section must still reach the next one */
+        if (i + 1 < ctx->section_count && ctx->sections[i + 1].bank != s->bank &&
+            (s->end == s->start || !isDefinitionIn(instr_list[s->end - 1].instruction, ctx->barrier_defs, 4))) {
+            s->fallthrough = true;
+            fill[s->bank]++;
+            ctx->bp->fallthrough_jumps++;
+        }
+    }
+    for (uint8_t b = 0; b < ctx->bp->bank_count; b++) {
+        if (fill[b] > ROM_SIZE) {
+            return makeStatus(ERR_BANK_OVERFLOW, NO_POS, NO_POS, "Bank %u holds %u words of code, a bank holds %u. Move sections to another bank", b, fill[b], ROM_SIZE);
+        }
+        ctx->bp->banks[b].code_size = fill[b];
+        if (fill[b] > ctx->bp->common_base) {
+            ctx->bp->common_base = fill[b];
+        }
+    }
+    return (Status){.code = OK};
+}
+
+/* Return the symbol a transfer from src_bank to the given label must use, creating the trampoline on first use */
+Status routeThroughTrampoline(BankingContext *ctx, const char *label, uint8_t src_bank, uint8_t dst_bank, bool is_call, TokenNode **out) {
+    /* Spaces can never appear in a lexed symbol, so these names cannot clash with user labels */
+    char name[128];
+    if (is_call) {
+        snprintf(name, sizeof(name), "%s call%u", label, src_bank);
+    } else {
+        snprintf(name, sizeof(name), "%s jump", label);
+    }
+    ctx->bp->cross_refs++;
+
+    uint16_t *idx = getPointerInHashMap(ctx->tramp_map, name);
+    if (idx) {
+        *out = ctx->trampolines[*idx].tok;
+        return (Status){.code = OK};
+    }
+
+    uint16_t size = is_call ? CALL_TRAMPOLINE_SIZE : JUMP_TRAMPOLINE_SIZE;
+    if (ctx->trampoline_count >= MAX_TRAMPOLINES || ctx->bp->common_base + ctx->bp->common_size + size > ROM_SIZE) {
+        return makeStatus(ERR_BANK_OVERFLOW, NO_POS, NO_POS, "No room for the trampoline to '%s': the fullest bank holds %u words of code and trampolines already use %u, a bank holds %u", label, ctx->bp->common_base, ctx->bp->common_size, ROM_SIZE);
+    }
+    uint16_t new_idx = ctx->trampoline_count;
+    if (!insertHashMap(ctx->tramp_map, name, &new_idx, sizeof(uint16_t))) {
+        return makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Failed insertion of the trampoline to '%s'", label);
+    }
+    ctx->trampolines[ctx->trampoline_count++] = (Trampoline){
+        .label = label,
+        .tok = pushSyntheticToken(ctx->tl, name, TOK_MNEMONIC, 0),
+        .offset = ctx->bp->common_size,
+        .src_bank = src_bank,
+        .dst_bank = dst_bank,
+        .is_call = is_call};
+    ctx->bp->common_size += size;
+    if (is_call) {
+        ctx->bp->call_trampolines++;
+    } else {
+        ctx->bp->jump_trampolines++;
+    }
+    *out = ctx->trampolines[new_idx].tok;
+    return (Status){.code = OK};
+}
+
+/* Copy a section into the image of a bank, sending ADDR operands to other banks through trampolines */
+Status copySection(BankingContext *ctx, const Section *s, uint8_t bank, Instruction *instr_list) {
+    Instruction *image = &ctx->bp->banks[bank].image[s->addr];
+    uint16_t len = s->end - s->start;
+    memcpy(image, &instr_list[s->start], len * sizeof(Instruction));
+
+    for (uint16_t j = 0; j < len; j++) {
+        Instruction *instr = &image[j];
+        if (!instr->instruction || instr->instruction->arg_type != ADDR) {
+            continue;
+        }
+        uint16_t *loc = getPointerInHashMap(ctx->sym_map, instr->arg1->tok.name);
+        if (!loc) { /* Reported as undefined by the linker */
+            continue;
+        }
+        Section *target = sectionOf(ctx, *loc);
+        if (target->bank == bank || (target == &ctx->sections[0] && ctx->replicate_leading)) {
+            continue;
+        }
+        bool is_call = isDefinitionIn(instr->instruction, ctx->call_defs, 5);
+        Status res = routeThroughTrampoline(ctx, instr->arg1->tok.name, bank, target->bank, is_call, &instr->arg1);
+        if (res.code != OK) {
+            return res;
+        }
+    }
+    return (Status){.code = OK};
+}
+
+/* Copy the sections into their bank images, and the leading section into every bank when it holds the interrupt handler */
+Status fillBankImages(BankingContext *ctx, Instruction *instr_list) {
+    for (uint16_t i = 0; i < ctx->section_count; i++) {
+        Section *s = &ctx->sections[i];
+        Instruction *image = &ctx->bp->banks[s->bank].image[s->addr];
+        uint16_t len = s->end - s->start;
+        for (uint8_t b = 0; b < ctx->bp->bank_count; b++) {
+            if (b == s->bank || (i == 0 && ctx->replicate_leading)) {
+                Status res = copySection(ctx, s, b, instr_list);
+                if (res.code != OK) {
+                    return res;
+                }
+            }
+        }
+
+        if (s->fallthrough) {
+            Section *next = &ctx->sections[i + 1];
+            image[len] = (Instruction){.instruction = ctx->jmp_def};
+            Status res = routeThroughTrampoline(ctx, next->label, s->bank, next->bank, false, &image[len].arg1);
+            if (res.code != OK) {
+                return res;
+            }
+        }
+    }
+    return (Status){.code = OK};
+}
+
+/* Emit the trampolines and replicate them at the same address in every bank */
+Status fillCommonArea(BankingContext *ctx, Instruction *instr_list, uint16_t instr_count) {
+    BankedProgram *bp = ctx->bp;
+    if (ctx->trampoline_count == 0) {
+        for (uint8_t b = 0; b < bp->bank_count; b++) {
+            bp->banks[b].size = bp->banks[b].code_size;
+        }
+        return (Status){.code = OK};
+    }
+
+    /* The trampolines clobber the scratch register, so the program must leave it alone */
+    for (uint16_t i = 0; i < instr_count; i++) {
+        TokenNode *args[2] = {instr_list[i].arg1, instr_list[i].arg2};
+        for (size_t a = 0; a < 2; a++) {
+            if (args[a] && args[a]->tok.type == TOK_REGISTER && args[a]->tok.value == ctx->ls->reg) {
+                return makeStatus(ERR_BANK_SCRIPT, args[a]->tok.line, args[a]->tok.col, "Register '%s' is reserved for bank switching (REG in the linker script)", args[a]->tok.name);
+            }
+        }
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), "%%%u", ctx->ls->reg);
+    ctx->reg_tok = pushSyntheticToken(ctx->tl, name, TOK_REGISTER, ctx->ls->reg);
+    snprintf(name, sizeof(name), "%u", ctx->ls->port);
+    ctx->port_tok = pushSyntheticToken(ctx->tl, name, TOK_NUMBER, ctx->ls->port);
+    for (uint8_t b = 0; b < bp->bank_count; b++) {
+        snprintf(name, sizeof(name), "%u", b);
+        ctx->bank_toks[b] = pushSyntheticToken(ctx->tl, name, TOK_NUMBER, b);
+    }
+
+    Instruction common[ROM_SIZE];
+    for (uint16_t t = 0; t < ctx->trampoline_count; t++) {
+        Trampoline *tr = &ctx->trampolines[t];
+        Instruction *out = &common[tr->offset];
+        TokenNode *target = pushSyntheticToken(ctx->tl, tr->label, TOK_MNEMONIC, 0);
+        out[0] = (Instruction){.instruction = ctx->load_def, .arg1 = ctx->reg_tok, .arg2 = ctx->bank_toks[tr->dst_bank]};
+        out[1] = (Instruction){.instruction = ctx->outputp_def, .arg1 = ctx->reg_tok, .arg2 = ctx->port_tok};
+        if (tr->is_call) {
+            out[2] = (Instruction){.instruction = ctx->call_defs[0], .arg1 = target};
+            out[3] = (Instruction){.instruction = ctx->load_def, .arg1 = ctx->reg_tok, .arg2 = ctx->bank_toks[tr->src_bank]};
+            out[4] = (Instruction){.instruction = ctx->outputp_def, .arg1 = ctx->reg_tok, .arg2 = ctx->port_tok};
+            out[5] = (Instruction){.instruction = ctx->ret_def};
+        } else {
+            out[2] = (Instruction){.instruction = ctx->jmp_def, .arg1 = target};
+        }
+    }
+
+    for (uint8_t b = 0; b < bp->bank_count; b++) {
+        Bank *bank = &bp->banks[b];
+        for (uint16_t a = bank->code_size; a < bp->common_base; a++) {
+            bank->image[a] = (Instruction){.instruction = &pad_def};
+        }
+        memcpy(&bank->image[bp->common_base], common, bp->common_size * sizeof(Instruction));
+        bank->size = bp->common_base + bp->common_size;
+    }
+    return (Status){.code = OK};
+}
+
+/* Resolve every label to its address inside its own bank and every trampoline to its common area address.
+   Cross-bank operands were rewritten to trampolines, so a single table serves all banks */
+Status linkBanks(BankingContext *ctx) {
+    BankedProgram *bp = ctx->bp;
+    size_t capacity = 16;
+    while (capacity < 2 * (ctx->sym_map->size + ctx->trampoline_count)) {
+        capacity <<= 1;
+    }
+    HashMap *bank_map = NULL;
+    if (!allocHashMap(&bank_map, capacity)) {
+        return makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Error allocating bank symbol hash map");
+    }
+
+    Status res = {.code = OK};
+    for (size_t i = 0; i < ctx->sym_map->capacity && res.code == OK; i++) {
+        Slot *slot = &ctx->sym_map->slots[i];
+        if (!slot->key) {
+            continue;
+        }
+        uint16_t loc = *(uint16_t *)slot->value;
+        Section *s = sectionOf(ctx, loc);
+        uint16_t addr = s->addr + (loc - s->start);
+        if (!insertHashMap(bank_map, slot->key, &addr, sizeof(uint16_t))) {
+            res = makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Failed insertion of symbol '%s' into the bank symbol table", slot->key);
+        }
+    }
+    for (uint16_t t = 0; t < ctx->trampoline_count && res.code == OK; t++) {
+        Trampoline *tr = &ctx->trampolines[t];
+        uint16_t addr = bp->common_base + tr->offset;
+        if (!insertHashMap(bank_map, tr->tok->tok.name, &addr, sizeof(uint16_t))) {
+            res = makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Failed insertion of trampoline '%s' into the bank symbol table", tr->tok->tok.name);
+        }
+    }
+    for (uint8_t b = 0; b < bp->bank_count && res.code == OK; b++) {
+        res = link(bp->banks[b].image, bp->banks[b].size, bank_map, NULL);
+    }
+    deallocHashMap(bank_map);
+    return res;
+}
+
+/* Split a parsed program into ROM banks following the linker script, then link every bank image.
+   References inside a bank are resolved directly, only transfers between banks pay for a trampoline */
+Status bankProgram(BankedProgram *bp, const LinkerScript *ls, TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t instr_count) {
+    memset(bp, 0, sizeof(*bp));
+    BankingContext *ctx = (BankingContext *)calloc(1, sizeof(BankingContext));
+    if (!ctx) {
+        return makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Error allocating banking context");
+    }
+    ctx->bp = bp;
+    ctx->ls = ls;
+    ctx->tl = tl;
+    ctx->sym_map = sym_map;
+
+    Status res = lookupBankingDefinitions(ctx, inst_map);
+    if (res.code == OK && !allocHashMap(&ctx->tramp_map, 2 * ROM_SIZE)) {
+        res = makeStatus(ERR_BANK_INTERNAL, NO_POS, NO_POS, "Error allocating trampoline hash map");
+    }
+    if (res.code == OK) {
+        res = buildSections(ctx, instr_count);
+    }
+    if (res.code == OK) {
+        res = checkInterruptLayout(ctx, instr_list);
+    }
+    if (res.code == OK) {
+        res = placeSections(ctx, instr_list);
+    }
+    if (res.code == OK) {
+        res = fillBankImages(ctx, instr_list);
+    }
+    if (res.code == OK) {
+        res = fillCommonArea(ctx, instr_list, instr_count);
+    }
+    if (res.code == OK) {
+        res = linkBanks(ctx);
+    }
+    if (ctx->tramp_map) {
+        deallocHashMap(ctx->tramp_map);
+    }
+    free(ctx);
+    return res;
+}
+
+/* Print the fill level of every bank and the cost of the trampolines */
+void printBankReport(const BankedProgram *bp) {
+    for (uint8_t b = 0; b < bp->bank_count; b++) {
+        const Bank *bank = &bp->banks[b];
+        fprintf(stdout, "[BANK %u]: %u/%u words (%.1f%%), code: %u, padding: %u, trampolines: %u\n",
+                b, bank->size, ROM_SIZE, 100.0 * bank->size / ROM_SIZE, bank->code_size,
+                bank->size - bank->code_size - bp->common_size, bp->common_size);
+    }
+    fprintf(stdout, "[BANKING]: %u call + %u jump trampolines, %u words per bank (%u in total), %u cross-bank references, %u fall-through jumps\n",
+            bp->call_trampolines, bp->jump_trampolines, bp->common_size, bp->common_size * bp->bank_count, bp->cross_refs, bp->fallthrough_jumps);
+    if (bp->interrupt_size) {
+        fprintf(stdout, "[BANKING]: %u words of interrupt handling code copied into every bank\n", bp->interrupt_size);
+    }
+    fprintf(stdout, "[BANKING]: A cross-bank CALL executes %u extra instructions, a cross-bank jump %u\n", CALL_TRAMPOLINE_OVERHEAD, JUMP_TRAMPOLINE_OVERHEAD);
+}
@@ -0,0 +1,296 @@
+#include <stdbool.h>
+#include <string.h>
+#include "format.h"
+
+#define MAX_FIELD_WIDTH 32
+#define MAX_DEC_DIGITS 5 /* Fields are at most 16 bits wide */
+#define MAX_HEX_DIGITS 4
+#define MAX_BIN_DIGITS 16
+
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+static const char HEX_LOWER[] = "0123456789abcdef";
+static const char NIBBLE_BITS[16][4] = {
+    {'0', '0', '0', '0'}, {'0', '0', '0', '1'}, {'0', '0', '1', '0'}, {'0', '0', '1', '1'},
+    {'0', '1', '0', '0'}, {'0', '1', '0', '1'}, {'0', '1', '1', '0'}, {'0', '1', '1', '1'},
+    {'1', '0', '0', '0'}, {'1', '0', '0', '1'}, {'1', '0', '1', '0'}, {'1', '0', '1', '1'},
+    {'1', '1', '0', '0'}, {'1', '1', '0', '1'}, {'1', '1', '1', '0'}, {'1', '1', '1', '1'},
+};
+
+static Status templateError(const char *src, const char *p, const char *msg) {
+    return makeStatus(ERR_FORMAT_TEMPLATE, 1, (uint16_t)(p - src + 1), "Invalid output template: %s", msg);
+}
+
+static bool pushOp(FormatTemplate *t, FormatOp op) {
+    if (t->op_count == MAX_FORMAT_OPS) {
+        return false;
+    }
+    t->ops[t->op_count++] = op;
+    return true;
+}
+
+/* Append one literal character, merged into the text operation before it when there is one */
+static bool pushText(FormatTemplate *t, char c) {
+    if (t->text_len == MAX_FORMAT_TEXT) {
+        return false;
+    }
+    FormatOp *last = t->op_count ? &t->ops[t->op_count - 1] : NULL;
+    if (!last || last->kind != FMT_TEXT || last->text_off + last->text_len != t->text_len) {
+        if (!pushOp(t, (FormatOp){.kind = FMT_TEXT, .text_off = t->text_len})) {
+            return false;
+        }
+        last = &t->ops[t->op_count - 1];
+    }
+    t->text[t->text_len++] = c;
+    last->text_len++;
+    return true;
+}
+
+/* Reads a '\' escape or a doubled brace, returns the character it stands for or 0 */
+static char readEscape(const char **p) {
+    const char *q = *p;
+    if (q[0] == '\\') {
+        char c = q[1] == 'n' ? '\n' : q[1] == 't' ? '\t' : q[1] == '\\' ? '\\' : 0;
+        if (c) {
+            *p += 2;
+        }
+        return c;
+    }
+    if ((q[0] == '{' && q[1] == '{') || (q[0] == '}' && q[1] == '}')) {
+        *p += 2;
+        return q[0];
+    }
+    return 0;
+}
+
+static unsigned readNumber(const char **p) {
+    unsigned n = 0;
+    while (**p >= '0' && **p <= '9' && n <= UINT16_MAX) {
+        n = n * 10 + (unsigned)(**p - '0');
+        (*p)++;
+    }
+    return n;
+}
+
+/* Compile a template once, the output is then produced by renderTemplate without parsing anything per instruction */
+Status compileTemplate(FormatTemplate *t, const char *src) {
+    memset(t, 0, sizeof(*t));
+    const char *p = src;
+    while (*p) {
+        char c = readEscape(&p);
+        if (c || *p != '{') {
+            if (*p == '}' && !c) {
+                return templateError(src, p, "unmatched '}', write '}}' for a literal brace");
+            }
+            if (!pushText(t, c ? c : *p++)) {
+                return templateError(src, p, "template too long");
+            }
+            continue;
+        }
+        const char *field_start = p++;
+        size_t name_len = strcspn(p, ":}");
+        FormatOp op = {.pad = ' '};
+        if (name_len == 5 && !strncmp(p, "every", 5) && p[5] == ':') {
+            p += 6;
+            const char *num = p;
+            op.kind = FMT_EVERY;
+            unsigned every = readNumber(&p);
+            if (p == num || every == 0 || every > UINT16_MAX || *p != ':') {
+                return templateError(src, num, "expected {every:N:text} with N > 0");
+            }
+            op.every = (uint16_t)every;
+            op.text_off = t->text_len;
+            p++;
+            for (;;) { /* Escapes work as outside, so '}}' is a literal brace and a single '}' ends the text */
+                char e = readEscape(&p);
+                if (!e && (*p == '\0' || *p == '}')) {
+                    break;
+                }
+                if (!e && *p == '{') {
+                    return templateError(src, p, "fields can not be nested in every text, write '{{' for a literal brace");
+                }
+                if (t->text_len == MAX_FORMAT_TEXT) {
+                    return templateError(src, p, "template too long");
+                }
+                t->text[t->text_len++] = e ? e : *p++;
+                op.text_len++;
+            }
+        } else {
+            if (name_len == 4 && !strncmp(p, "addr", 4)) {
+                op = (FormatOp){.kind = FMT_DEC, .field = FIELD_ADDR, .pad = ' '};
+            } else if (name_len == 4 && !strncmp(p, "word", 4)) {
+                op = (FormatOp){.kind = FMT_HEX, .field = FIELD_WORD, .width = 4, .pad = '0'};
+            } else {
+                return templateError(src, p, "unknown field, expected addr, word or every");
+            }
+            p += name_len;
+            if (*p == ':') {
+                p++;
+                op.pad = ' ';
+                if (*p == '0') {
+                    op.pad = '0';
+                    p++;
+                }
+                unsigned width = readNumber(&p);
+                if (width > MAX_FIELD_WIDTH) {
+                    return templateError(src, p, "field width too large");
+                }
+                op.width = (uint8_t)width;
+                if (*p == 'd') {
+                    op.kind = FMT_DEC;
+                } else if (*p == 'x' || *p == 'X') {
+                    op.kind = FMT_HEX;
+                    op.lowercase = *p == 'x';
+                } else if (*p == 'b') {
+                    op.kind = FMT_BIN;
+                } else {
+                    return templateError(src, p, "expected conversion d, x, X or b");
+                }
+                p++;
+                if (op.kind == FMT_BIN) {
+                    unsigned bits = op.width ? op.width : (op.field == FIELD_WORD ? 16 : 8);
+                    if (bits > MAX_BIN_DIGITS) {
+                        return templateError(src, p, "binary fields are at most 16 bits wide");
+                    }
+                    op.width = (uint8_t)bits;
+                    unsigned group = readNumber(&p);
+                    if (group > bits) {
+                        return templateError(src, p, "binary group larger than the field");
+                    }
+                    op.group = (uint8_t)group;
+                }
+            }
+        }
+        if (*p != '}') {
+            return templateError(src, field_start, "unterminated field");
+        }
+        p++;
+        if (!pushOp(t, op)) {
+            return templateError(src, field_start, "too many fields");
+        }
+    }
+    const FormatOp *last = t->op_count ? &t->ops[t->op_count - 1] : NULL;
+    if (!last || last->kind != FMT_TEXT || t->text[last->text_off + last->text_len - 1] != '\n') {
+        if (!pushText(t, '\n')) {
+            return templateError(src, p, "template too long");
+        }
+    }
+    /* Worst case length of a line, used to size the output buffer */
+    for (uint16_t i = 0; i < t->op_count; i++) {
+        const FormatOp *op = &t->ops[i];
+        switch (op->kind) {
+        case FMT_TEXT:
+        case FMT_EVERY:
+            t->max_line += op->text_len;
+            break;
+        case FMT_DEC:
+            t->max_line += op->width > MAX_DEC_DIGITS ? op->width : MAX_DEC_DIGITS;
+            break;
+        case FMT_HEX:
+            t->max_line += op->width > MAX_HEX_DIGITS ? op->width : MAX_HEX_DIGITS;
+            break;
+        case FMT_BIN:
+            t->max_line += op->width + (op->group ? (op->width - 1) / op->group : 0);
+            break;
+        }
+    }
+    return (Status){.code = OK};
+}
+
+static size_t pad(char *out, size_t digits, const FormatOp *op) {
+    size_t n = op->width > digits ? op->width - digits : 0;
+    memset(out, op->pad, n);
+    return n;
+}
+
+/* Decimal digits are produced two at a time from a table instead of dividing once per digit */
+static size_t putDecimal(char *out, uint16_t v, const FormatOp *op) {
+    char digits[MAX_DEC_DIGITS];
+    char *d = digits + sizeof(digits);
+    while (v >= 100) {
+        unsigned pair = (v % 100) * 2;
+        v /= 100;
+        *--d = DIGIT_PAIRS[pair + 1];
+        *--d = DIGIT_PAIRS[pair];
+    }
+    if (v >= 10) {
+        *--d = DIGIT_PAIRS[v * 2 + 1];
+        *--d = DIGIT_PAIRS[v * 2];
+    } else {
+        *--d = (char)('0' + v);
+    }
+    size_t count = (size_t)(digits + sizeof(digits) - d);
+    size_t n = pad(out, count, op);
+    memcpy(out + n, d, count);
+    return n + count;
+}
+
+static size_t putHex(char *out, uint16_t v, const FormatOp *op) {
+    const char *table = op->lowercase ? HEX_LOWER : HEX_UPPER;
+    size_t count = v > 0xFFF ? 4 : v > 0xFF ? 3 : v > 0xF ? 2 : 1;
+    size_t n = pad(out, count, op);
+    for (size_t i = count; i-- > 0;) {
+        out[n++] = table[(v >> (4 * i)) & 0xF];
+    }
+    return n;
+}
+
+static size_t putBinary(char *out, uint16_t v, const FormatOp *op) {
+    size_t n = 0;
+    if (op->width % 4 == 0 && (op->group == 0 || op->group == 4)) { /* Whole nibbles, copied from the table */
+        for (int shift = op->width - 4; shift >= 0; shift -= 4) {
+            memcpy(out + n, NIBBLE_BITS[(v >> shift) & 0xF], 4);
+            n += 4;
+            if (op->group && shift) {
+                out[n++] = ' ';
+            }
+        }
+        return n;
+    }
+    for (int bit = op->width - 1; bit >= 0; bit--) {
+        out[n++] = (char)('0' + ((v >> bit) & 1));
+        if (op->group && bit && bit % op->group == 0) {
+            out[n++] = ' ';
+        }
+    }
+    return n;
+}
+
+/* Write the line of one instruction to out, which must hold t->max_line bytes. Returns the length written */
+size_t renderTemplate(const FormatTemplate *t, char *out, uint16_t addr, uint16_t word) {
+    size_t len = 0;
+    for (uint16_t i = 0; i < t->op_count; i++) {
+        const FormatOp *op = &t->ops[i];
+        uint16_t v = op->field == FIELD_ADDR ? addr : word;
+        switch (op->kind) {
+        case FMT_EVERY:
+            if (addr % op->every != 0) {
+                break;
+            }
+            /* fall through */
+        case FMT_TEXT:
+            memcpy(out + len, t->text + op->text_off, op->text_len);
+            len += op->text_len;
+            break;
+        case FMT_DEC:
+            len += putDecimal(out + len, v, op);
+            break;
+        case FMT_HEX:
+            len += putHex(out + len, v, op);
+            break;
+        case FMT_BIN:
+            len += putBinary(out + len, v, op);
+            break;
+        }
+    }
+    return len;
+}
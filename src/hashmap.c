@@ -27,7 +27,33 @@ bool allocHashMap(HashMap **map, const size_t slot_count) {
     return true;
 }
 
+/* Double the slot count and move every entry to its new bucket, keys and values are moved, not copied */
+bool growHashMap(HashMap *t) {
+    size_t capacity = t->capacity * 2;
+    Slot *slots = (Slot *)calloc(capacity, sizeof(Slot));
+    if (!slots) {
+        return false;
+    }
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->slots[i].key) {
+            size_t idx = t->slots[i].hash & (capacity - 1);
+            while (slots[idx].key) {
+                idx = (idx + 1) & (capacity - 1);
+            }
+            slots[idx] = t->slots[i];
+        }
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    return true;
+}
+
 bool insertHashMap(HashMap *t, const char *key, const void *value, size_t value_size) {
+    /* Keep the table at most half full so probe chains stay short, the entries are moved when it grows */
+    if (2 * (t->size + 1) > t->capacity && !getPointerInHashMap(t, key)) {
+        growHashMap(t);
+    }
     uint32_t hash = fnv1a32(key);
     /* Hash the initial bucket*/
     size_t idx = hash & (t->capacity - 1);
@@ -62,8 +88,7 @@ bool insertHashMap(HashMap *t, const char *key, const void *value, size_t value_
         /* On collision linear probe next idx */
         idx = (idx + 1) & (t->capacity - 1);
     }
-    /* Table is full */
-    // TODO: Resize / handle gracefully
+    /* Table is full, growing it failed */
     return false;
 }
 
@@ -74,7 +99,7 @@ bool searchHashMap(HashMap *t, const char *key, void *out_value, size_t value_si
         Slot *slot = &t->slots[idx];
         if (slot->key == NULL) {
             /* First encouter is a NULL means key is not in the table
-               Based on the assumption no deletions are allowed, which is the case */
+               removeHashMap keeps every probe chain free of holes, so this holds */
             return false;
         }
         if (slot->hash == hash && strcmp(slot->key, key) == 0) {
@@ -112,6 +137,49 @@ void *getPointerInHashMap(HashMap *t, const char *key) {
     return NULL;
 }
 
+/* Remove an entry, the entries probed after it are moved back so a lookup still stops at the first empty slot */
+bool removeHashMap(HashMap *t, const char *key) {
+    uint32_t hash = fnv1a32(key);
+    size_t mask = t->capacity - 1;
+    size_t idx = hash & mask;
+    for (size_t probe = 0; probe < t->capacity; probe++) {
+        Slot *slot = &t->slots[idx];
+        if (slot->key == NULL) {
+            return false;
+        }
+        if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+            free(slot->key);
+            free(slot->value);
+            size_t hole = idx;
+            size_t next = (idx + 1) & mask;
+            for (size_t n = 1; n < t->capacity && t->slots[next].key; n++) {
+                /* An entry may fill the hole unless its home bucket lies between the hole and itself */
+                size_t home = t->slots[next].hash & mask;
+                if (((next - home) & mask) >= ((next - hole) & mask)) {
+                    t->slots[hole] = t->slots[next];
+                    hole = next;
+                }
+                next = (next + 1) & mask;
+            }
+            memset(&t->slots[hole], 0, sizeof(Slot));
+            t->size--;
+            return true;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return false;
+}
+
+/* Remove every entry, the slots are kept for reuse */
+void clearHashMap(HashMap *t) {
+    for (size_t idx = 0; idx < t->capacity; idx++) {
+        free(t->slots[idx].key);
+        free(t->slots[idx].value);
+    }
+    memset(t->slots, 0, t->capacity * sizeof(Slot));
+    t->size = 0;
+}
+
 void deallocHashMap(HashMap *t) {
     for (size_t idx = 0; idx < t->capacity; idx++) {
         free(t->slots[idx].key);
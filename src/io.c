@@ -1,3 +1,15 @@
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "io.h"
 #include "lexer.h"
 #include "status.h"
@@ -10,8 +22,17 @@ const char *getProgramName(const char *path) {
     }
     return p ? p + 1 : path;
 }
+/* Number of processors available, used as the default --serve worker count */
+unsigned getCpuCount(void) {
+#ifndef _WIN32
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+#else
+    return 1;
+#endif
+}
 /* Process individual line by sterilizing it and classifying the tokens to the token list*/
-Status processLine(TokenList *tl, char *line, uint8_t line_number) {
+Status processLine(TokenList *tl, char *line, uint32_t line_number) {
     uint8_t col_number = 1;
     char *tkn;
     char *rest = line;
@@ -20,6 +41,10 @@ Status processLine(TokenList *tl, char *line, uint8_t line_number) {
             /* Handles both: ;comm and ; comm */
             break;
         }
+        if (isDirective(tkn)) {
+            /* The rest of the line is one token, the parser decodes it straight into the image */
+            return classifyDirective(tl, tkn, rest, line_number, col_number);
+        }
         Status token_ok = classifyToken(tl, tkn, line_number, col_number);
         if (token_ok.code != OK) {
             return token_ok;
@@ -28,76 +53,398 @@ Status processLine(TokenList *tl, char *line, uint8_t line_number) {
     }
     return (Status){.code = OK};
 }
-/* Read the given file and populate the token list with the contents */
-Status readTokensFromFile(TokenList *tl, const char *f_name) {
+/* Read a whole file into memory, works for pipes and devices too, which can not be mapped */
+static Status readWholeFile(const char *f_name, char **data, size_t *size) {
     FILE *fp = fopen(f_name, "r");
     if (!fp) {
         return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not open file: %s", f_name);
     }
-    uint8_t line_number = 1;
+    size_t capacity = 64 * 1024;
+    size_t len = 0;
+    char *buf = (char *)malloc(capacity);
+    while (buf) {
+        len += fread(buf + len, 1, capacity - len, fp);
+        if (len < capacity) {
+            break;
+        }
+        capacity *= 2;
+        char *grown = (char *)realloc(buf, capacity);
+        if (!grown) {
+            free(buf);
+        }
+        buf = grown;
+    }
+    bool read_ok = buf && !ferror(fp);
+    fclose(fp);
+    if (!read_ok) {
+        free(buf);
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not read file: %s", f_name);
+    }
+    *data = buf;
+    *size = len;
+    return (Status){.code = OK};
+}
 
-    char line[255];
-    while (fgets(line, 255, fp)) {
-        Status line_ok = processLine(tl, line, line_number);
+/* A newline aligned slice of the input, lexed on its own with line numbers counted from 1 */
+typedef struct {
+    const char *start;
+    const char *end;
+    TokenList tokens;
+    DiagSink diag;
+    uint32_t lines;
+    unsigned error_count;
+    StatusCode first_error;
+} LexChunk;
+
+/* Lex a chunk line by line. Lines are cut the way fgets with a LEX_LINE_SIZE buffer cuts them,
+    so an overlong line counts as several lines exactly as when the file was read serially
+*/
+static void lexChunk(LexChunk *chunk) {
+    char line[LEX_LINE_SIZE];
+    const char *p = chunk->start;
+    while (p < chunk->end) {
+        size_t n = (size_t)(chunk->end - p);
+        if (n > LEX_LINE_SIZE - 1) {
+            n = LEX_LINE_SIZE - 1;
+        }
+        const char *nl = (const char *)memchr(p, '\n', n);
+        if (nl) {
+            n = (size_t)(nl - p) + 1;
+        }
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p += n;
+        chunk->lines++;
+        Status line_ok = processLine(&chunk->tokens, line, chunk->lines);
         if (line_ok.code != OK) {
-            fclose(fp);
-            return line_ok;
+            diagReport(&chunk->diag, &line_ok, "TOKEN");
+            chunk->first_error = chunk->error_count++ ? chunk->first_error : line_ok.code;
+        }
+    }
+}
+
+#ifndef _WIN32
+typedef struct {
+    LexChunk *chunks;
+    size_t chunk_count;
+    atomic_size_t next;
+} LexJob;
+
+/* Pool worker, takes the next unclaimed chunk until none are left */
+static void *lexWorker(void *arg) {
+    LexJob *job = (LexJob *)arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->chunk_count) {
+        lexChunk(&job->chunks[i]);
+    }
+    return NULL;
+}
+#endif
+
+/* Lex every chunk, on up to thread_count threads, the calling thread included */
+static void lexChunks(LexChunk *chunks, size_t chunk_count, unsigned thread_count) {
+#ifndef _WIN32
+    LexJob job = {.chunks = chunks, .chunk_count = chunk_count};
+    atomic_init(&job.next, 0);
+    pthread_t threads[MAX_LEX_THREADS];
+    unsigned started = 0;
+    while (started + 1 < thread_count && started + 1 < chunk_count) {
+        if (pthread_create(&threads[started], NULL, lexWorker, &job) != 0) {
+            break; /* The threads already running and this one do the rest */
+        }
+        started++;
+    }
+    lexWorker(&job);
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#else
+    (void)thread_count;
+    for (size_t i = 0; i < chunk_count; i++) {
+        lexChunk(&chunks[i]);
+    }
+#endif
+}
+
+/* Read the given file and populate the token list with the contents, see readTokensFromBuffer */
+Status readTokensFromFile(TokenList *tl, const char *f_name, DiagSink *sink, unsigned thread_count) {
+    /* Regular files are mapped, pipes and devices have no size to map and are read instead */
+    MappedFile mf = {0};
+    char *copy = NULL;
+    size_t size = 0;
+#ifndef _WIN32
+    Status read_ok = mapFile(&mf, f_name);
+    if (read_ok.code == OK && mf.size == 0) {
+        read_ok = readWholeFile(f_name, &copy, &size);
+    }
+#else
+    Status read_ok = readWholeFile(f_name, &copy, &size); /* Text mode translates line endings, as fgets did */
+#endif
+    if (read_ok.code != OK) {
+        return read_ok;
+    }
+    const char *data = copy ? copy : (const char *)mf.data;
+    size = copy ? size : mf.size;
+    Status res = readTokensFromBuffer(tl, data, size, f_name, sink, thread_count);
+    free(copy);
+    unmapFile(&mf);
+    return res;
+}
+
+/* Populate the token list from source text, name is only used in messages
+    Large sources are split at newlines into chunks lexed in parallel, the chunk results are then renumbered
+    and appended in source order, so tokens and diagnostics are the same as when lexing serially.
+    A bad line is reported to the sink while its text is still around, then lexing goes on with the next line
+*/
+Status readTokensFromBuffer(TokenList *tl, const char *data, size_t size, const char *name, DiagSink *sink, unsigned thread_count) {
+    if (thread_count < 1 || tl->arena) { /* An arena is not shared between threads */
+        thread_count = 1;
+    } else if (thread_count > MAX_LEX_THREADS) {
+        thread_count = MAX_LEX_THREADS;
+    }
+    /* A few chunks per thread even out lines of different cost */
+    size_t chunk_count = thread_count > 1 ? size / LEX_MIN_CHUNK_SIZE : 1;
+    if (chunk_count > 4 * (size_t)thread_count) {
+        chunk_count = 4 * (size_t)thread_count;
+    } else if (chunk_count < 1) {
+        chunk_count = 1;
+    }
+    LexChunk *chunks = (LexChunk *)calloc(chunk_count, sizeof(LexChunk));
+    if (!chunks) {
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Error allocating the lexer chunks for %s", name);
+    }
+    const char *p = data;
+    const char *end = data + size;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char *stop = (i + 1 == chunk_count) ? end : data + size / chunk_count * (i + 1);
+        if (stop < p) {
+            stop = p;
+        }
+        const char *nl = stop < end ? (const char *)memchr(stop, '\n', (size_t)(end - stop)) : NULL;
+        stop = (i + 1 == chunk_count || !nl) ? end : nl + 1;
+        chunks[i].start = p;
+        chunks[i].end = stop;
+        tokenListInitArena(&chunks[i].tokens, tl->arena);
+        diagInit(&chunks[i].diag);
+        p = stop;
+    }
+
+    lexChunks(chunks, chunk_count, thread_count);
+
+    StatusCode first_error = OK;
+    unsigned error_count = 0;
+    uint32_t line_base = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        LexChunk *chunk = &chunks[i];
+        if (line_base) {
+            for (SllNode *n = chunk->tokens.list.head; n; n = n->next) {
+                CONTAINER_OF(n, TokenNode, link)->tok.line += line_base;
+            }
+            for (size_t d = 0; d < chunk->diag.count; d++) {
+                chunk->diag.items[d].line += line_base;
+            }
         }
-        line_number++;
+        if (chunk->tokens.list.head) {
+            if (tl->list.tail) {
+                tl->list.tail->next = chunk->tokens.list.head;
+            } else {
+                tl->list.head = chunk->tokens.list.head;
+            }
+            tl->list.tail = chunk->tokens.list.tail;
+        }
+        diagMerge(sink, &chunk->diag);
+        first_error = error_count ? first_error : chunk->first_error;
+        error_count += chunk->error_count;
+        line_base += chunk->lines;
+    }
+    free(chunks);
+    if (error_count) {
+        return makeStatus(first_error, NO_POS, NO_POS, "%u lexing error(s) in '%s'", error_count, name);
+    }
+    return (Status){.code = OK};
+}
+/* Map the whole file read-only. Falls back to reading it into memory where mmap is not available */
+Status mapFile(MappedFile *mf, const char *f_name) {
+    *mf = (MappedFile){0};
+#ifndef _WIN32
+    int fd = open(f_name, O_RDONLY);
+    if (fd < 0) {
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not open file: %s", f_name);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not stat file: %s", f_name);
+    }
+    mf->size = (size_t)st.st_size;
+    if (mf->size > 0) { /* Mapping 0 bytes is an error, an empty file is simply an empty view */
+        void *addr = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not map file: %s", f_name);
+        }
+        mf->data = addr;
+        mf->mapped = true;
+    }
+    close(fd);
+#else
+    FILE *fp = fopen(f_name, "rb");
+    if (!fp) {
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not open file: %s", f_name);
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? (uint8_t *)malloc((size_t)size) : NULL;
+    if (size > 0 && (!buf || fread(buf, 1, (size_t)size, fp) != (size_t)size)) {
+        free(buf);
+        fclose(fp);
+        return makeStatus(ERR_IO_INVALID_FILE, NO_POS, NO_POS, "Could not read file: %s", f_name);
     }
     fclose(fp);
+    mf->data = buf;
+    mf->size = size > 0 ? (size_t)size : 0;
+#endif
     return (Status){.code = OK};
 }
-/* Takes the list of instructions inside instr_list and writes it to the given file using the specified formatter */
-Status writeInstructionsToFile(Instruction *instr_list, const char *f_name, FormatterFn formatter) {
-    if (!instr_list || !formatter) {
-        return makeStatus(ERR_IO_EMPTY_INSTRUCTION_LIST, NO_POS, NO_POS, "Missing instructions or formatter");
+
+void unmapFile(MappedFile *mf) {
+#ifndef _WIN32
+    if (mf->mapped) {
+        munmap((void *)mf->data, mf->size);
     }
+#else
+    free((void *)mf->data);
+#endif
+    *mf = (MappedFile){0};
+}
+
+#ifndef _WIN32
+/* Write a file in place, for devices and pipes which can not be renamed over */
+Status writeFileDirect(const char *f_name, const void *data, size_t size) {
     FILE *fp = fopen(f_name, "w");
     if (!fp) {
         return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed openning the file %s in write mode.", f_name);
     }
-    char line_buf[64];
-    for (uint8_t i = 0; instr_list[i].instruction != NULL; ++i) {
-        formatter(line_buf, sizeof(line_buf), i, &instr_list[i]);
-        fprintf(fp, "%s", line_buf);
+    bool write_ok = fwrite(data, 1, size, fp) == size;
+    if ((fclose(fp) != 0) || !write_ok) {
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed writing the file %s", f_name);
     }
-    fclose(fp);
     return (Status){.code = OK};
 }
+#endif
 
-/* Custom Formatter functions, new ones can be implemented easily by following the schema */
-
-void VHDL_STYLE_HEX(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
-    snprintf(buf, buf_size, " \"%u\" => x\"%04X\",\n", line_number, instr->raw);
+/* Replace the contents of a file atomically: the data goes to a temporary file next to it, which is then renamed over it,
+    so readers see either the old or the new contents. With WRITE_IF_CHANGED an identical file is not rewritten at all.
+    A replaced file keeps its permissions, a new one gets 0666 minus the umask. Symbolic links are followed: the file
+    they point at is replaced and the link stays, as when the file was written in place
+*/
+Status writeFileAtomic(const char *f_name, const void *data, size_t size, WriteMode mode) {
+    if (mode == WRITE_IF_CHANGED) {
+        MappedFile old;
+        if (mapFile(&old, f_name).code == OK) {
+            bool same = old.size == size && (size == 0 || memcmp(old.data, data, size) == 0);
+            unmapFile(&old);
+            if (same) {
+                return (Status){.code = OK};
+            }
+        }
+    }
+#ifndef _WIN32
+    struct stat st;
+    bool exists = stat(f_name, &st) == 0;
+    if (exists && !S_ISREG(st.st_mode)) {
+        return writeFileDirect(f_name, data, size);
+    }
+    const char *path = f_name;
+    char target[PATH_MAX];
+    struct stat link_st;
+    if (lstat(f_name, &link_st) == 0 && S_ISLNK(link_st.st_mode)) {
+        if (!realpath(f_name, target)) { /* Dangling link, writing through it creates the file it points at */
+            return writeFileDirect(f_name, data, size);
+        }
+        path = target;
+    }
+    char tmp_name[PATH_MAX + 32];
+    int fd = -1;
+    for (unsigned attempt = 0; fd < 0 && attempt < 100; attempt++) {
+        snprintf(tmp_name, sizeof(tmp_name), "%s.%ld.%u.tmp", path, (long)getpid(), attempt);
+        fd = open(tmp_name, O_WRONLY | O_CREAT | O_EXCL, 0666); /* The umask applies, as for any new file */
+        if (fd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    if (fd < 0) {
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed creating a temporary file next to %s", path);
+    }
+    if (exists && fchmod(fd, st.st_mode & 07777) != 0) {
+        close(fd);
+        unlink(tmp_name);
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed giving the replacement of %s its mode", path);
+    }
+    const uint8_t *p = (const uint8_t *)data;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t written = write(fd, p, left);
+        if (written <= 0) {
+            break;
+        }
+        p += written;
+        left -= (size_t)written;
+    }
+    if (close(fd) != 0 || left > 0) {
+        unlink(tmp_name);
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed writing the file %s", f_name);
+    }
+    if (rename(tmp_name, path) != 0) {
+        unlink(tmp_name);
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed replacing the file %s", path);
+    }
+#else
+    /* rename does not replace an existing file here, so the swap is not atomic */
+    char tmp_name[4096];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", f_name);
+    FILE *fp = fopen(tmp_name, "wb");
+    if (!fp) {
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed openning the file %s in write mode.", tmp_name);
+    }
+    bool write_ok = fwrite(data, 1, size, fp) == size;
+    write_ok = (fclose(fp) == 0) && write_ok;
+    remove(f_name);
+    if (!write_ok || rename(tmp_name, f_name) != 0) {
+        remove(tmp_name);
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Failed writing the file %s", f_name);
+    }
+#endif
+    return (Status){.code = OK};
 }
 
-void VHDL_STYLE_BIN(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
-    char binary[17];
-    for (int i = 15; i >= 0; i--) {
-        binary[15 - i] = (instr->raw & (1 << i)) ? '1' : '0';
+/* Render count instructions with the output template, out must hold count * format->max_line bytes. Returns the length written */
+size_t renderInstructions(const Instruction *instr_list, size_t count, const FormatTemplate *format, char *out) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += renderTemplate(format, out + len, (uint16_t)i, instr_list[i].raw);
     }
-    binary[16] = '\0';
-    snprintf(buf, buf_size, " \"%u\" => b\"%s\",\n", line_number, binary);
+    return len;
 }
 
-void DEBUG(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
-    char head[64] = "";
-    char binary[64];
-    if (line_number % 10 == 0) {
-        snprintf(head, sizeof(head), "      FEDC BA98 7654 3210\n");
-    }
-    int pos = 0;
-    for (int i = 15; i >= 0; i--) {
-        binary[pos++] = (instr->raw & (1 << i)) ? '1' : '0';
-        if (i % 4 == 0 && i != 0) {
-            binary[pos++] = ' ';
-        }
-    }
-    binary[pos] = '\0';
-    if (line_number % 10 == 0) {
-        snprintf(buf, buf_size, " %s%.3u => %s\n", head, line_number, binary);
-    } else {
-        snprintf(buf, buf_size, "%.3u => %s\n", line_number, binary);
-    }
-}
\ No newline at end of file
+/* Takes the list of instructions inside instr_list and writes it to the given file using the specified output template
+    The whole image is rendered in memory first, so it can be compared against the existing file and replaced at once
+*/
+Status writeInstructionsToFile(Instruction *instr_list, const char *f_name, const FormatTemplate *format, WriteMode mode) {
+    if (!instr_list || !format) {
+        return makeStatus(ERR_IO_EMPTY_INSTRUCTION_LIST, NO_POS, NO_POS, "Missing instructions or output template");
+    }
+    size_t count = 0;
+    while (instr_list[count].instruction != NULL) {
+        count++;
+    }
+    char *image = (char *)malloc(count * format->max_line + 1);
+    if (!image) {
+        return makeStatus(ERR_IO_FAIL_OPEN_FILE, NO_POS, NO_POS, "Error allocating the output image for %s", f_name);
+    }
+    size_t len = renderInstructions(instr_list, count, format, image);
+    Status res = writeFileAtomic(f_name, image, len, mode);
+    free(image);
+    return res;
+}
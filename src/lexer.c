@@ -39,19 +39,66 @@ bool isDecimal(const char *p, uint16_t *binary_out) {
     return true;
 }
 
+/* DW and INCBIN take the rest of the line as operands */
+bool isDirective(const char *tkn) {
+    return !strcmp(tkn, "DW") || !strcmp(tkn, "INCBIN");
+}
+
+/* Add a directive with its operands as a single token, so a long word list does not produce a token per value
+    DW keeps the value list, INCBIN the file path without the quotes
+*/
+Status classifyDirective(TokenList *tl, const char *tkn, char *operands, const uint32_t line_number, const uint8_t col_number) {
+    uint8_t kind = !strcmp(tkn, "DW") ? DIRECTIVE_DW : DIRECTIVE_INCBIN;
+    char *start = operands + strspn(operands, " ,\t\r\n");
+    char *end = NULL;
+    if (kind == DIRECTIVE_INCBIN && *start == '"') {
+        end = strchr(++start, '"');
+        if (!end) {
+            return makeStatus(ERR_LEX_DIRECTIVE, line_number, col_number, "Unterminated file name in INCBIN");
+        }
+        const char *trail = end + 1 + strspn(end + 1, " \t\r\n");
+        if (*trail != '\0' && *trail != ';') {
+            return makeStatus(ERR_LEX_DIRECTIVE, line_number, col_number, "INCBIN takes a single file name");
+        }
+    } else {
+        end = start + strcspn(start, ";");
+        while (end > start && strchr(" ,\t\r\n", end[-1])) {
+            end--;
+        }
+        if (kind == DIRECTIVE_INCBIN && start + strcspn(start, " ,\t") < end) {
+            return makeStatus(ERR_LEX_DIRECTIVE, line_number, col_number, "INCBIN takes a single file name, quote names containing blanks");
+        }
+    }
+    if (end == start) {
+        return makeStatus(ERR_LEX_DIRECTIVE, line_number, col_number, kind == DIRECTIVE_DW ? "DW expects at least one value" : "INCBIN expects a file name");
+    }
+    *end = '\0';
+    tokenListPushBack(tl, (Token){.name = tokenListDup(tl, start), .type = TOK_DIRECTIVE, .value = kind, .line = line_number, .col = col_number});
+    return (Status){.code = OK};
+}
+
 /* Classify a given token and add it to the token list
     Also pefrom basic checks on values for bounds/max values
  */
-Status classifyToken(TokenList *tl, const char *tkn, const uint8_t line_number, const uint8_t col_number) {
-    if (tkn[0] == '#') { /* Classify as label */
-        if (strlen(tkn) > 1) {
-            tokenListPushBack(tl, (Token){.name = strdup(tkn + 1), .type = TOK_LABEL, .value = 0, .line = line_number, .col = col_number});
+Status classifyToken(TokenList *tl, const char *tkn, const uint32_t line_number, const uint8_t col_number) {
+    if (tkn[0] == '#') { /* Classify as label, '##' also exports it */
+        uint8_t flags = (tkn[1] == '#') ? LABEL_EXPORTED : 0;
+        const char *name = tkn + ((flags & LABEL_EXPORTED) ? 2 : 1);
+        if (*name != '\0') {
+            tokenListPushBack(tl, (Token){.name = tokenListDup(tl, name), .type = TOK_LABEL, .value = flags, .line = line_number, .col = col_number});
             return (Status){.code = OK};
         }
         return makeStatus(ERR_LEX_LABEL_DEFINITION, line_number, col_number, "Bad label definition: '%s'. Label(#) must be immediately followed by a name", tkn);
     }
 
     uint16_t value = 0;
+    if (tkn[0] == '%' && tkn[1] == 'v' && tkn[2] == '.') { /* Virtual register %v.<name>, mapped onto a physical one by the register allocator */
+        if (tkn[3] == '\0') {
+            return makeStatus(ERR_LEX_REG_INDEX, line_number, col_number, "Bad virtual register: '%s'. '%%v.' must be followed by a name", tkn);
+        }
+        tokenListPushBack(tl, (Token){.name = tokenListDup(tl, tkn), .type = TOK_REGISTER, .value = REGISTER_VIRTUAL, .line = line_number, .col = col_number});
+        return (Status){.code = OK};
+    }
     if (tkn[0] == '%') { /* Classify as register, allows format: %[Decimal: from 0 to 15] */
         if (isDecimal(tkn + 1, &value) == false) {
             return makeStatus(ERR_LEX_REG_INDEX, line_number, col_number, "Bad register index: '%s'. Register index must be a decimal number", tkn);
@@ -60,7 +107,7 @@ Status classifyToken(TokenList *tl, const char *tkn, const uint8_t line_number,
         if (value > 15) {
             return makeStatus(ERR_LEX_REG_BOUNDS, line_number, col_number, "Bad register index: '%s'. Register indexing out of bounds, maximum index 15. Use decimal representation [0 - 15]", tkn);
         }
-        tokenListPushBack(tl, (Token){.name = strdup(tkn), .type = TOK_REGISTER, .value = (uint8_t)value, .line = line_number, .col = col_number});
+        tokenListPushBack(tl, (Token){.name = tokenListDup(tl, tkn), .type = TOK_REGISTER, .value = (uint8_t)value, .line = line_number, .col = col_number});
         return (Status){.code = OK};
     }
 
@@ -69,13 +116,13 @@ Status classifyToken(TokenList *tl, const char *tkn, const uint8_t line_number,
             if (value > UINT8_MAX) {
                 return makeStatus(ERR_LEX_IMM_BOUNDS, line_number, col_number, "Bad binary immediate: '%s' (%u). Maximum representable binary immediate is %u", tkn, value, UINT8_MAX);
             }
-            tokenListPushBack(tl, (Token){.name = strdup(tkn + 2), .type = TOK_NUMBER, .value = (uint8_t)value, .line = line_number, .col = col_number});
+            tokenListPushBack(tl, (Token){.name = tokenListDup(tl, tkn + 2), .type = TOK_NUMBER, .value = (uint8_t)value, .line = line_number, .col = col_number});
             return (Status){.code = OK};
         } else if (tkn[1] == 'd' && isDecimal(tkn + 2, &value)) {
             if (value > UINT8_MAX) {
                 return makeStatus(ERR_LEX_IMM_BOUNDS, line_number, col_number, "Bad decimal immediate: '%s' (%u). Maximum representable decimal immediate is %u", tkn, value, UINT8_MAX);
             }
-            tokenListPushBack(tl, (Token){.name = strdup(tkn + 2), .type = TOK_NUMBER, .value = (uint8_t)value, .line = line_number, .col = col_number});
+            tokenListPushBack(tl, (Token){.name = tokenListDup(tl, tkn + 2), .type = TOK_NUMBER, .value = (uint8_t)value, .line = line_number, .col = col_number});
             return (Status){.code = OK};
         } else {
             return makeStatus(ERR_LEX_INVALID_IMM_FORMAT, line_number, col_number, "Invalid immediate type '%c'. Use b or d", tkn[1]);
@@ -84,10 +131,10 @@ Status classifyToken(TokenList *tl, const char *tkn, const uint8_t line_number,
     // TODO: Implement Hex Immediate type
     /* Allow for 0 for easier writing */
     if (!strcmp(tkn, "0")) {
-        tokenListPushBack(tl, (Token){.name = strdup("0"), .type = TOK_NUMBER, .value = 0, .line = line_number, .col = col_number});
+        tokenListPushBack(tl, (Token){.name = tokenListDup(tl, "0"), .type = TOK_NUMBER, .value = 0, .line = line_number, .col = col_number});
         return (Status){.code = OK};
     }
     /* Reaching here means it is probably the use of a label */
-    tokenListPushBack(tl, (Token){.name = strdup(tkn), .type = TOK_MNEMONIC, .value = 0, .line = line_number, .col = col_number});
+    tokenListPushBack(tl, (Token){.name = tokenListDup(tl, tkn), .type = TOK_MNEMONIC, .value = 0, .line = line_number, .col = col_number});
     return (Status){.code = OK};
 }
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "library.h"
+#include "parser.h"
+
+#define NO_ROUTINE 0xFFFF
+
+typedef struct {
+    LibrarySet *ls;
+    HashMap *sym_map;
+    Instruction *instr_list;
+    uint16_t count;
+
+    InstructionDefinition *jmp_def;
+    InstructionDefinition *ret_def;
+    InstructionDefinition *rete_def;
+    InstructionDefinition *retd_def;
+
+    uint16_t routine_of[MAX_PROGRAM_SIZE]; /* Library routine holding an instruction, NO_ROUTINE for the program */
+    uint16_t remap[MAX_PROGRAM_SIZE + 1];  /* New location of every instruction, or of the next kept one when stripped */
+    uint16_t worklist[MAX_PROGRAM_SIZE];
+    uint16_t pending;
+} StripContext;
+
+void initLibrarySet(LibrarySet *ls) {
+    memset(ls, 0, sizeof(*ls));
+    ls->interrupt_vector = NO_INTERRUPT_VECTOR;
+}
+
+/* Lex and parse a library after the instructions already placed, its labels join the program symbols */
+Status loadLibrary(LibrarySet *ls, const char *path, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count, DiagSink *sink, unsigned thread_count) {
+    if (ls->library_count == MAX_LIBRARIES) {
+        return makeStatus(ERR_LIB_INTERNAL, NO_POS, NO_POS, "At most %u libraries can be used", MAX_LIBRARIES);
+    }
+    if (ls->library_count == 0) {
+        ls->program_size = *instr_count;
+    }
+    Library *lib = &ls->libraries[ls->library_count++];
+    lib->path = path;
+    lib->start = lib->end = *instr_count;
+    tokenListInit(&lib->tl);
+    Status res = readTokensFromFile(&lib->tl, path, sink, thread_count);
+    if (res.code == OK) {
+        res = parseTokenList(&lib->tl, inst_map, sym_map, instr_list, instr_count, sink);
+    }
+    lib->end = *instr_count;
+    return res;
+}
+
+/* Split every library into units starting at its labels, labels sharing a location name the same unit */
+Status collectRoutines(StripContext *ctx) {
+    LibrarySet *ls = ctx->ls;
+    ls->routines = (LibraryRoutine *)calloc(ctx->count - ls->program_size + 1, sizeof(LibraryRoutine));
+    if (!ls->routines) {
+        return makeStatus(ERR_LIB_INTERNAL, NO_POS, NO_POS, "Error allocating library routines");
+    }
+    for (uint16_t l = 0; l < ls->library_count; l++) {
+        const Library *lib = &ls->libraries[l];
+        uint16_t first = ls->routine_count;
+        for (SllNode *n = lib->tl.list.head; n; n = n->next) {
+            TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
+            uint16_t *loc = tn->tok.type == TOK_LABEL ? getPointerInHashMap(ctx->sym_map, tn->tok.name) : NULL;
+            if (!loc || *loc >= lib->end) {
+                continue;
+            }
+            if (ls->routine_count == first && *loc > lib->start) {
+                /* Code before the first label is only reached by falling into it */
+                ls->routines[ls->routine_count++] = (LibraryRoutine){.library = l, .start = lib->start};
+            }
+            if (ls->routine_count > first && ls->routines[ls->routine_count - 1].start == *loc) {
+                continue;
+            }
+            ls->routines[ls->routine_count++] = (LibraryRoutine){.name = tn->tok.name, .library = l, .start = *loc};
+        }
+        if (ls->routine_count == first && lib->end > lib->start) {
+            ls->routines[ls->routine_count++] = (LibraryRoutine){.library = l, .start = lib->start};
+        }
+        for (uint16_t r = first; r < ls->routine_count; r++) {
+            uint16_t end = (r + 1 < ls->routine_count) ? ls->routines[r + 1].start : lib->end;
+            ls->routines[r].size = end - ls->routines[r].start;
+            for (uint16_t i = ls->routines[r].start; i < end; i++) {
+                ctx->routine_of[i] = r;
+            }
+        }
+    }
+    return (Status){.code = OK};
+}
+
+void keepRoutine(StripContext *ctx, uint16_t routine, uint16_t reached_by) {
+    LibraryRoutine *r = &ctx->ls->routines[routine];
+    if (!r->kept) {
+        r->kept = true;
+        r->reached_by = reached_by;
+        ctx->worklist[ctx->pending++] = routine;
+    }
+}
+
+/* Keep the routines targeted by the CALL* / JMP* of a range of instructions */
+void keepReferencedRoutines(StripContext *ctx, uint16_t start, uint16_t end, uint16_t reached_by) {
+    for (uint16_t i = start; i < end; i++) {
+        const Instruction *instr = &ctx->instr_list[i];
+        if (!instr->instruction || instr->instruction->arg_type != ADDR || !instr->arg1) {
+            continue;
+        }
+        uint16_t *loc = getPointerInHashMap(ctx->sym_map, instr->arg1->tok.name);
+        if (loc && *loc < ctx->count && ctx->routine_of[*loc] != NO_ROUTINE) {
+            keepRoutine(ctx, ctx->routine_of[*loc], reached_by);
+        }
+    }
+}
+
+/* Execution continues into the next instruction unless it jumps, returns unconditionally or is data */
+bool fallsThrough(const StripContext *ctx, uint16_t idx) {
+    const InstructionDefinition *def = ctx->instr_list[idx].instruction;
+    return def && def != ctx->jmp_def && def != ctx->ret_def && def != ctx->rete_def && def != ctx->retd_def && def->arg_type != DATA;
+}
+
+/* The hardware enters the interrupt vector without a reference. In the program, the routine its instruction branches to
+    is kept. In a library, the vector must stay at its address, so every unit up to the one holding it is kept
+*/
+void keepInterruptRoutines(StripContext *ctx) {
+    uint16_t vector = ctx->ls->interrupt_vector;
+    if (vector >= ctx->count) {
+        return;
+    }
+    if (vector < ctx->ls->program_size) {
+        keepReferencedRoutines(ctx, vector, vector + 1, REACHED_BY_INTERRUPT);
+        return;
+    }
+    for (uint16_t r = 0; r <= ctx->routine_of[vector]; r++) {
+        keepRoutine(ctx, r, REACHED_BY_INTERRUPT);
+    }
+}
+
+/* Move the kept routines down onto the stripped ones and drop the labels of the stripped routines */
+void compactLibraries(StripContext *ctx) {
+    LibrarySet *ls = ctx->ls;
+    for (uint16_t i = 0; i < ls->program_size; i++) {
+        ctx->remap[i] = i;
+    }
+    uint16_t out = ls->program_size;
+    for (uint16_t i = ls->program_size; i < ctx->count; i++) {
+        ctx->remap[i] = out;
+        if (ls->routines[ctx->routine_of[i]].kept) {
+            ctx->instr_list[out++] = ctx->instr_list[i];
+        }
+    }
+    ctx->remap[ctx->count] = out;
+    memset(&ctx->instr_list[out], 0, (size_t)(ctx->count - out) * sizeof(Instruction));
+
+    for (uint16_t l = 0; l < ls->library_count; l++) {
+        for (SllNode *n = ls->libraries[l].tl.list.head; n; n = n->next) {
+            TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
+            uint16_t *loc = tn->tok.type == TOK_LABEL ? getPointerInHashMap(ctx->sym_map, tn->tok.name) : NULL;
+            if (loc && *loc < ctx->count && ctx->routine_of[*loc] != NO_ROUTINE && !ls->routines[ctx->routine_of[*loc]].kept) {
+                removeHashMap(ctx->sym_map, tn->tok.name);
+            }
+        }
+    }
+    for (size_t i = 0; i < ctx->sym_map->capacity; i++) {
+        Slot *slot = &ctx->sym_map->slots[i];
+        if (slot->key) {
+            uint16_t *loc = (uint16_t *)slot->value;
+            *loc = *loc <= ctx->count ? ctx->remap[*loc] : *loc;
+        }
+    }
+    ctx->count = out;
+}
+
+/* Keep only the library routines reachable from the program: the program is kept whole, a routine is kept when kept code
+    references one of its labels with an ADDR operand or runs into it, or when the interrupt vector leads to it.
+    The program must not be linked yet
+*/
+Status stripLibraries(LibrarySet *ls, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count) {
+    if (ls->library_count == 0) {
+        ls->program_size = ls->words_before = ls->words_after = *instr_count;
+        return (Status){.code = OK};
+    }
+    ls->words_before = *instr_count;
+    StripContext *ctx = (StripContext *)calloc(1, sizeof(StripContext));
+    if (!ctx) {
+        return makeStatus(ERR_LIB_INTERNAL, NO_POS, NO_POS, "Error allocating library stripping context");
+    }
+    ctx->ls = ls;
+    ctx->sym_map = sym_map;
+    ctx->instr_list = instr_list;
+    ctx->count = *instr_count;
+    ctx->jmp_def = getPointerInHashMap(inst_map, "JMP");
+    ctx->ret_def = getPointerInHashMap(inst_map, "RET");
+    ctx->rete_def = getPointerInHashMap(inst_map, "RETE");
+    ctx->retd_def = getPointerInHashMap(inst_map, "RETD");
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        ctx->routine_of[i] = NO_ROUTINE;
+    }
+
+    Status res = collectRoutines(ctx);
+    if (res.code != OK) {
+        free(ctx);
+        return res;
+    }
+    keepInterruptRoutines(ctx);
+    keepReferencedRoutines(ctx, 0, ls->program_size, REACHED_BY_PROGRAM);
+    if (ls->program_size > 0 && ls->routine_count > 0 && fallsThrough(ctx, ls->program_size - 1)) {
+        keepRoutine(ctx, 0, REACHED_BY_PROGRAM);
+    }
+    while (ctx->pending > 0) {
+        uint16_t r = ctx->worklist[--ctx->pending];
+        uint16_t end = ls->routines[r].start + ls->routines[r].size;
+        keepReferencedRoutines(ctx, ls->routines[r].start, end, r);
+        if (r + 1 < ls->routine_count && fallsThrough(ctx, end - 1)) {
+            keepRoutine(ctx, r + 1, r);
+        }
+    }
+
+    compactLibraries(ctx);
+    *instr_count = ls->words_after = ctx->count;
+    free(ctx);
+    return (Status){.code = OK};
+}
+
+const char *routineName(const LibrarySet *ls, uint16_t routine) {
+    if (routine == REACHED_BY_PROGRAM) {
+        return "program";
+    }
+    if (routine == REACHED_BY_INTERRUPT) {
+        return "interrupt";
+    }
+    return ls->routines[routine].name ? ls->routines[routine].name : "(start of library)";
+}
+
+/* The map header and the line of a routine, called with no buffer first to size the map exactly */
+size_t formatMapHeader(const LibrarySet *ls, char *out, size_t size) {
+    int n = snprintf(out, size, "; program: %u words, libraries: %u -> %u words\n; %-8s %5s  %-24s %-24s %s\n",
+                     ls->program_size, ls->words_before - ls->program_size, ls->words_after - ls->program_size,
+                     "status", "words", "routine", "kept for", "library");
+    return n > 0 ? (size_t)n : 0;
+}
+
+size_t formatMapLine(const LibrarySet *ls, uint16_t r, char *out, size_t size) {
+    const LibraryRoutine *routine = &ls->routines[r];
+    int n = snprintf(out, size, "%-10s %5u  %-24s %-24s %s\n", routine->kept ? "kept" : "stripped", routine->size,
+                     routineName(ls, r), routine->kept ? routineName(ls, routine->reached_by) : "-", ls->libraries[routine->library].path);
+    return n > 0 ? (size_t)n : 0;
+}
+
+/* Write one line per library routine: kept or stripped, its size in words, what kept it and its library */
+Status writeLibraryMap(const LibrarySet *ls, const char *f_name, WriteMode mode) {
+    size_t cap = formatMapHeader(ls, NULL, 0) + 1;
+    for (uint16_t r = 0; r < ls->routine_count; r++) {
+        cap += formatMapLine(ls, r, NULL, 0);
+    }
+    char *buf = (char *)malloc(cap);
+    if (!buf) {
+        return makeStatus(ERR_LIB_INTERNAL, NO_POS, NO_POS, "Error allocating library map");
+    }
+    size_t len = formatMapHeader(ls, buf, cap);
+    for (uint16_t r = 0; r < ls->routine_count; r++) {
+        len += formatMapLine(ls, r, buf + len, cap - len);
+    }
+    Status res = writeFileAtomic(f_name, buf, len, mode);
+    free(buf);
+    return res;
+}
+
+void printLibraryReport(const LibrarySet *ls) {
+    uint16_t kept = 0;
+    for (uint16_t r = 0; r < ls->routine_count; r++) {
+        kept += ls->routines[r].kept;
+    }
+    fprintf(stdout, "[LIBRARY]: kept %u of %u routine(s) from %u librar%s, %u -> %u words (%u stripped)\n",
+            kept, ls->routine_count, ls->library_count, ls->library_count == 1 ? "y" : "ies",
+            ls->words_before, ls->words_after, ls->words_before - ls->words_after);
+}
+
+void deallocLibrarySet(LibrarySet *ls) {
+    for (uint16_t l = 0; l < ls->library_count; l++) {
+        deallocTokenList(&ls->libraries[l].tl);
+    }
+    free(ls->routines);
+    memset(ls, 0, sizeof(*ls));
+}
@@ -2,53 +2,78 @@
 #include "linker.h"
 #include "instruction.h"
 
-/* Link the instruction list against the symbol table and build the instructions
-    The parser would throw any invalid arg errors, so it is assured the arguments are valid
-    Iterate through all the instructions and create the raw instruction using the arguments and the symbols
-*/
-Status link(Instruction *instr_list, uint8_t instr_count, HashMap *sym_map) {
-    for (uint8_t idx = 0; idx < instr_count; idx++) {
-        Instruction *instr = &instr_list[idx];
-        InstructionDefinition *def = instr->instruction;
-
-        if (!def) {
-            return makeStatus(ERR_LINK_MISSING_INSTRUCTION, idx, 0, "Missing instruction, failed link");
-        }
-        switch (def->arg_type) {
-        case NO_ARG: /* Means the instruction is hard-coded, so the content is already inside the mask*/
-            instr->raw = def->mask;
-            break;
+/* Build the raw instruction from its definition and arguments, ADDR operands are resolved against the symbol table */
+Status encodeInstruction(Instruction *instr, uint16_t idx, HashMap *sym_map) {
+    InstructionDefinition *def = instr->instruction;
+    if (!def) {
+        return makeStatus(ERR_LINK_MISSING_INSTRUCTION, idx, 0, "Missing instruction, failed link");
+    }
+    switch (def->arg_type) {
+    case NO_ARG: /* Means the instruction is hard-coded, so the content is already inside the mask*/
+        instr->raw = def->mask;
+        break;
 
-        case REG:
-            instr->raw = def->mask | (instr->arg1->tok.value << (def->arg1_start));
-            break;
+    case REG:
+        instr->raw = def->mask | (instr->arg1->tok.value << (def->arg1_start));
+        break;
 
-        case ADDR: { /* Means an address is expected, so search the symbol table for it */
-            uint8_t *addr = getPointerInHashMap(sym_map, instr->arg1->tok.name);
-            if (!addr) {
-                return makeStatus(ERR_LINK_SYMBOL_UNDEFINED, instr->arg1->tok.line, instr->arg1->tok.col, "Undefined symbol '%s'. Not found inside the symbol table", instr->arg1->tok.name);
-            }
-            instr->raw = def->mask | (*addr << (def->arg1_start));
-            break;
+    case ADDR: { /* Means an address is expected, so search the symbol table for it */
+        uint16_t *addr = getPointerInHashMap(sym_map, instr->arg1->tok.name);
+        if (!addr) {
+            return makeStatus(ERR_LINK_SYMBOL_UNDEFINED, instr->arg1->tok.line, instr->arg1->tok.col, "Undefined symbol '%s'. Not found inside the symbol table", instr->arg1->tok.name);
         }
-        case REG_REG: /* INPUT and OUTPUT*/
-        case REG_IMM: /* INPUTP and OUTPUTP*/
+        if (*addr > UINT8_MAX) { /* Only reachable through a bank switch, see banking.h */
+            return makeStatus(ERR_LINK_ADDR_RANGE, instr->arg1->tok.line, instr->arg1->tok.col, "Symbol '%s' at address %u does not fit in 8 bits. Use a linker script (-L) to bank the program", instr->arg1->tok.name, *addr);
+        }
+        instr->raw = def->mask | (*addr << (def->arg1_start));
+        break;
+    }
+    case REG_REG: /* INPUT and OUTPUT*/
+    case REG_IMM: /* INPUTP and OUTPUTP*/
+        instr->raw = def->mask | (instr->arg1->tok.value << (def->arg1_start));
+        instr->raw |= (instr->arg2->tok.value << (def->arg2_start));
+        break;
+    case REG_ANY:
+        if (instr->arg2->tok.type == TOK_REGISTER) {
             instr->raw = def->mask | (instr->arg1->tok.value << (def->arg1_start));
             instr->raw |= (instr->arg2->tok.value << (def->arg2_start));
-            break;
-        case REG_ANY:
-            if (instr->arg2->tok.type == TOK_REGISTER) {
-                instr->raw = def->mask | (instr->arg1->tok.value << (def->arg1_start));
-                instr->raw |= (instr->arg2->tok.value << (def->arg2_start));
-            } else {
-                instr->raw = ((uint16_t)def->mask) << 12;
-                instr->raw ^= (instr->arg1->tok.value << (def->arg1_start));
-                instr->raw ^= (instr->arg2->tok.value);
+        } else {
+            instr->raw = ((uint16_t)def->mask) << 12;
+            instr->raw ^= (instr->arg1->tok.value << (def->arg1_start));
+            instr->raw ^= (instr->arg2->tok.value);
+        }
+        break;
+    case DATA: /* Placed as is */
+        break;
+    default:
+        return makeStatus(ERR_LINK_UNKNOWN_ARG_TYPE, idx, 0, "Unknown arg type %u", def->arg_type);
+    }
+    return (Status){.code = OK};
+}
+
+/* Link the instruction list against the symbol table and build the instructions
+    The parser would throw any invalid arg errors, so it is assured the arguments are valid
+    Iterate through all the instructions and create the raw instruction using the arguments and the symbols
+    With a sink every unresolved instruction is reported, without one linking stops at the first error
+*/
+Status link(Instruction *instr_list, uint16_t instr_count, HashMap *sym_map, DiagSink *sink) {
+    if (instr_count > ROM_SIZE) {
+        return makeStatus(ERR_LINK_ADDR_RANGE, NO_POS, NO_POS, "Program contains %u instructions, a ROM bank holds %u. Use a linker script (-L) to bank the program", instr_count, ROM_SIZE);
+    }
+    StatusCode first_error = OK;
+    unsigned error_count = 0;
+    for (uint16_t idx = 0; idx < instr_count; idx++) {
+        Status res = encodeInstruction(&instr_list[idx], idx, sym_map);
+        if (res.code != OK) {
+            if (!sink) {
+                return res;
             }
-            break;
-        default:
-            return makeStatus(ERR_LINK_UNKNOWN_ARG_TYPE, idx, 0, "Unknown arg type %u", def->arg_type);
+            diagReport(sink, &res, "LINKING");
+            first_error = error_count++ ? first_error : res.code;
         }
     }
+    if (error_count) {
+        return makeStatus(first_error, NO_POS, NO_POS, "%u linking error(s)", error_count);
+    }
     return (Status){.code = OK};
-}
\ No newline at end of file
+}
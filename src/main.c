@@ -1,14 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <getopt.h>
 #include "status.h"
 #include "token_list.h"
 #include "hashmap.h"
 #include "io.h"
+#include "format.h"
 #include "instruction.h"
 #include "linker.h"
 #include "parser.h"
+#include "banking.h"
+#include "outline.h"
+#include "regalloc.h"
+#include "library.h"
+#include "object.h"
+#include "server.h"
 
 #define DEFAULT_INPUT_FILE "in.txt"
 #define DEFAULT_OUTPUT_FILE "out.txt"
@@ -17,11 +24,31 @@ int main(int argc, char *argv[]) {
     const char *in_path = DEFAULT_INPUT_FILE;
     const char *out_path = DEFAULT_OUTPUT_FILE;
     const char *program_name = getProgramName(argv[0]);
-    FormatterFn formatter = DEBUG;
+    const char *script_path = NULL;
+    bool compile_only = false;
+    WriteMode write_mode = WRITE_ALWAYS;
+    unsigned lex_threads = 0; /* -j, 0 until given */
+    const char *template_src = FORMAT_DEBUG;
+    bool serve = false;
+    bool optimize_size = false;
+    const char *socket_path = NULL;
+    const char *library_paths[MAX_LIBRARIES];
+    int library_count = 0;
+    const char *map_path = NULL;
+    unsigned interrupt_vector = NO_INTERRUPT_VECTOR;
+    int exit_status = EXIT_SUCCESS; /* Assembly errors are only reported on the console, --serve failing sets it */
 
+    static const struct option long_options[] = {
+        {"serve", optional_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0},
+    };
     int opt;
-    while ((opt = getopt(argc, argv, "i:o:f:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:f:T:L:O:j:l:M:I:cuh", long_options, NULL)) != -1) {
         switch (opt) {
+        case 'S':
+            serve = true;
+            socket_path = optarg;
+            break;
         case 'i':
             in_path = optarg;
             break;
@@ -30,36 +57,115 @@ int main(int argc, char *argv[]) {
             break;
         case 'f':
             if (!strcmp(optarg, "debug")) {
-                formatter = DEBUG;
+                template_src = FORMAT_DEBUG;
             } else if (!strcmp(optarg, "vhdlbin")) {
-                formatter = VHDL_STYLE_BIN;
+                template_src = FORMAT_VHDL_BIN;
             } else if (!strcmp(optarg, "vhdlhex")) {
-                formatter = VHDL_STYLE_HEX;
+                template_src = FORMAT_VHDL_HEX;
             } else {
                 fprintf(stderr, "[pico-assembler] Invalid format: %s\n", optarg);
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'T':
+            template_src = optarg;
+            break;
+        case 'L':
+            script_path = optarg;
+            break;
+        case 'O':
+            if (strcmp(optarg, "s")) {
+                fprintf(stderr, "[pico-assembler] Invalid optimization: -O%s, only -Os is supported\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            optimize_size = true;
+            break;
+        case 'j':
+            lex_threads = (unsigned)strtoul(optarg, NULL, 10);
+            if (lex_threads < 1 || lex_threads > MAX_LEX_THREADS) {
+                fprintf(stderr, "[pico-assembler] Invalid thread count: %s, expected 1 to %d\n", optarg, MAX_LEX_THREADS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            if (library_count == MAX_LIBRARIES) {
+                fprintf(stderr, "[pico-assembler] Too many libraries, at most %d can be used\n", MAX_LIBRARIES);
+                exit(EXIT_FAILURE);
+            }
+            library_paths[library_count++] = optarg;
+            break;
+        case 'M':
+            map_path = optarg;
+            break;
+        case 'I':
+            interrupt_vector = (unsigned)strtoul(optarg, NULL, 10);
+            if (interrupt_vector >= MAX_PROGRAM_SIZE) {
+                fprintf(stderr, "[pico-assembler] Invalid interrupt vector: %s, expected an address below %d\n", optarg, MAX_PROGRAM_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            compile_only = true;
+            break;
+        case 'u':
+            write_mode = WRITE_IF_CHANGED;
+            break;
         case 'h':
-            printf("[pico-assembler] Usage: %s [-i input_file] [-o output_file] [-f format]\n", program_name);
+            printf("[pico-assembler] Usage: %s [-i input_file] [-o output_file] [-f format] [-T template] [-L linker_script] [-j threads] [-l library]... [-M map_file] [-I vector] [-Os] [-c] [-u]\n", program_name);
+            printf("       %s [-o output_file] [-f format] [-T template] [-u] <object_file>...\n", program_name);
+            printf("       %s --serve[=socket_path] [-j workers]\n", program_name);
             printf("Options: \n");
             printf("    -i <file>   Input file (default: %s) \n", DEFAULT_INPUT_FILE);
             printf("    -o <file>   Output file (default: %s) \n", DEFAULT_OUTPUT_FILE);
             printf("    -f <format> Output format: debug, vhdlbin, vhdlhex \n");
+            printf("    -T <text>   Output template, e.g. '\"{addr:d}\" => x\"{word:04X}\",' (overrides -f) \n");
+            printf("    -L <file>   Linker script, splits the program into 256 word banks written to <output_file>.bank<n> \n");
+            printf("    -j <n>      Threads lexing large inputs (default: 1, see pico-bench-lex) \n");
+            printf("    -l <file>   Routine library, only the routines the program reaches are kept. Can be repeated \n");
+            printf("    -M <file>   Write the kept and stripped library routines with their sizes \n");
+            printf("    -I <addr>   Interrupt vector address, library routines it leads to are kept \n");
+            printf("    -Os         Outline repeated instruction sequences into subroutines to save ROM words \n");
+            printf("    -c          Assemble only, write a relocatable object to <output_file>. Kept library routines become part of it, -L can not be used \n");
+            printf("    -u          Leave output files untouched when their contents did not change \n");
+            printf("    --serve     Stay resident and answer JSON requests, one per line, from stdin or the given Unix socket. -j sets the worker count (default: processor count) \n");
+            printf("    Object files given after the options are linked into <output_file> \n");
             printf("    -h          Show Help message");
             exit(EXIT_SUCCESS);
         default:
-            fprintf(stderr, "[pico-assembler] Usage: %s [-i input_file] [-o output_file] [-f format]\nUse: '%s -h' for help", program_name, program_name);
+            fprintf(stderr, "[pico-assembler] Usage: %s [-i input_file] [-o output_file] [-f format] [-T template] [-L linker_script] [-j threads] [-l library]... [-M map_file] [-I vector] [-Os] [-c] [-u] [object_file...]\nUse: '%s -h' for help", program_name, program_name);
             exit(EXIT_FAILURE);
         }
     }
+    if (compile_only && script_path) {
+        fprintf(stderr, "[pico-assembler] -L can not be used with -c, objects are linked into a single bank\n");
+        exit(EXIT_FAILURE);
+    }
 
-    Instruction instruction_list[256];
+    /* The output template is compiled once, before any work is done */
+    FormatTemplate format;
+    Status format_ok = compileTemplate(&format, template_src);
+    if (format_ok.code != OK) {
+        printStatus(&format_ok, "OUTPUT TEMPLATE");
+        exit(EXIT_FAILURE);
+    }
+
+    /* One extra empty entry terminates the list for writeInstructionsToFile */
+    Instruction instruction_list[MAX_PROGRAM_SIZE + 1];
     memset(instruction_list, 0, sizeof(instruction_list));
 
     TokenList tl;
     tokenListInit(&tl);
 
+    LinkerScript script = {0};
+    LibrarySet libraries;
+    initLibrarySet(&libraries);
+    libraries.interrupt_vector = (uint16_t)interrupt_vector;
+    BankedProgram *banked = NULL;
+
+    /* Errors found while lexing, parsing and linking are collected and printed together at the end of each step */
+    DiagSink diag;
+    diagInit(&diag);
+
     HashMap *instruction_set = NULL;
     bool instr_set_ok = allocHashMap(&instruction_set, HASH_MAP_BUCKETS);
     if (!instr_set_ok) {
@@ -138,8 +244,40 @@ int main(int argc, char *argv[]) {
     insertHashMap(instruction_set, "INTE", &(InstructionDefinition){.mask = 0b1000000011110000, .arg_type = NO_ARG}, sizeof(InstructionDefinition));
     insertHashMap(instruction_set, "INTD", &(InstructionDefinition){.mask = 0b1000000011010000, .arg_type = NO_ARG}, sizeof(InstructionDefinition));
 
+    if (serve) {
+        /* Resident mode, the instruction set built above is shared by every request */
+        exit_status = runServer(socket_path, lex_threads ? lex_threads : getCpuCount(), instruction_set);
+        goto cleanup;
+    }
+
+    if (lex_threads == 0) {
+        lex_threads = 1; /* Splitting the lexing has not shown a speedup yet, pico-bench-lex measures it */
+    }
+    if (optind < argc) {
+        /* Link relocatable objects produced with -c, no source is read */
+        if (library_count > 0) {
+            fprintf(stderr, "[pico-assembler] Libraries are assembled into a module with -c, they can not be linked with objects\n");
+            goto cleanup;
+        }
+        uint16_t obj_loc = 0;
+        Status obj_ok = linkObjectFiles(instruction_list, &obj_loc, (const char **)&argv[optind], argc - optind, &diag);
+        diagFlush(&diag);
+        printStatus(&obj_ok, "LINKING OBJECTS");
+        if (obj_ok.code != OK) {
+            goto cleanup;
+        }
+        Status write_ok = writeInstructionsToFile(instruction_list, out_path, &format, write_mode);
+        printStatus(&write_ok, "WRITE TO FILE");
+        if (write_ok.code != OK) {
+            goto cleanup;
+        }
+        printf("[pico-assembler] Successfully linked %d objects. Wrote to '%s'.", argc - optind, out_path);
+        goto cleanup;
+    }
+
     /* Perform lexing */
-    Status read_ok = readTokensFromFile(&tl, in_path);
+    Status read_ok = readTokensFromFile(&tl, in_path, &diag, lex_threads);
+    diagFlush(&diag);
     printStatus(&read_ok, "I/O + TOKEN");
     if (read_ok.code != OK) {
         goto cleanup;
@@ -147,17 +285,122 @@ int main(int argc, char *argv[]) {
 
     /* Perform parsing */
     uint16_t loc = 0;
-    Status parse_ok = parseTokenList(&tl, instruction_set, symbol_set, instruction_list, &loc);
+    Status parse_ok = parseTokenList(&tl, instruction_set, symbol_set, instruction_list, &loc, &diag);
+    diagFlush(&diag);
     printStatus(&parse_ok, "PARSE");
     if (parse_ok.code != OK) {
         goto cleanup;
     }
 
+    /* Place the libraries after the program and strip the routines it never reaches */
+    for (int l = 0; l < library_count; l++) {
+        Status lib_ok = loadLibrary(&libraries, library_paths[l], instruction_set, symbol_set, instruction_list, &loc, &diag, lex_threads);
+        diagFlush(&diag);
+        printStatus(&lib_ok, "LIBRARY");
+        if (lib_ok.code != OK) {
+            goto cleanup;
+        }
+    }
+    Status strip_ok = stripLibraries(&libraries, instruction_set, symbol_set, instruction_list, &loc);
+    if (strip_ok.code != OK) {
+        printStatus(&strip_ok, "LIBRARY STRIPPING");
+        goto cleanup;
+    }
+    if (library_count > 0) {
+        printLibraryReport(&libraries);
+    }
+    if (map_path) {
+        Status map_ok = writeLibraryMap(&libraries, map_path, write_mode);
+        printStatus(&map_ok, "WRITE MAP");
+        if (map_ok.code != OK) {
+            goto cleanup;
+        }
+    }
+
+    if (script_path) {
+        /* Read before allocating registers, the scratch register of the bank trampolines is never handed out */
+        Status script_ok = readLinkerScript(&script, script_path, &diag);
+        diagFlush(&diag);
+        printStatus(&script_ok, "LINKER SCRIPT");
+        if (script_ok.code != OK) {
+            goto cleanup;
+        }
+    }
+
+    /* Map the virtual registers, a program using none is left untouched */
+    RegAllocReport *regs = (RegAllocReport *)malloc(sizeof(RegAllocReport));
+    if (!regs) {
+        printf("Error allocating register allocation report");
+        goto cleanup;
+    }
+    uint16_t reserved_regs = script_path ? (uint16_t)(1u << script.reg) : 0;
+    Status alloc_ok = allocateRegisters(regs, instruction_set, symbol_set, instruction_list, &loc, reserved_regs, &diag);
+    diagFlush(&diag);
+    if (alloc_ok.code != OK || regs->virtual_count) {
+        printStatus(&alloc_ok, "REGISTER ALLOCATION");
+    }
+    if (alloc_ok.code == OK) {
+        printRegAllocReport(regs);
+    }
+    free(regs);
+    if (alloc_ok.code != OK) {
+        goto cleanup;
+    }
+
+    if (optimize_size) {
+        /* Outline before placing the program, so the words saved count against the ROM and bank sizes */
+        OutlineReport outline;
+        Status outline_ok = outlineProgram(&outline, &tl, instruction_set, symbol_set, instruction_list, &loc);
+        printStatus(&outline_ok, "OUTLINE");
+        if (outline_ok.code != OK) {
+            goto cleanup;
+        }
+        printOutlineReport(&outline);
+    }
+
+    if (compile_only) {
+        /* Emit a relocatable object, symbols from other objects are resolved by the link step */
+        Status obj_ok = writeObjectFile(instruction_list, loc, &tl, symbol_set, out_path, write_mode);
+        printStatus(&obj_ok, "WRITE OBJECT");
+        if (obj_ok.code != OK) {
+            goto cleanup;
+        }
+        printf("[pico-assembler] Successfully assembled '%s'. Wrote object to '%s'.", in_path, out_path);
+        goto cleanup;
+    }
+
+    if (script_path) {
+        /* Perform banking, every bank is linked on its own and written to a separate file */
+        banked = (BankedProgram *)calloc(1, sizeof(BankedProgram));
+        if (!banked) {
+            printf("Error allocating banked program");
+            goto cleanup;
+        }
+        Status bank_ok = bankProgram(banked, &script, &tl, instruction_set, symbol_set, instruction_list, loc);
+        printStatus(&bank_ok, "BANKING + LINKING");
+        if (bank_ok.code != OK) {
+            goto cleanup;
+        }
+        char bank_path[512];
+        for (uint8_t b = 0; b < banked->bank_count; b++) {
+            makeBankFileName(bank_path, sizeof(bank_path), out_path, b);
+            Status write_ok = writeInstructionsToFile(banked->banks[b].image, bank_path, &format, write_mode);
+            printStatus(&write_ok, "WRITE TO FILE");
+            if (write_ok.code != OK) {
+                goto cleanup;
+            }
+        }
+        printBankReport(banked);
+        printf("[pico-assembler] Successfully assembled '%s' into %u banks. Wrote to '%s'.", in_path, banked->bank_count, out_path);
+        goto cleanup;
+    }
+
     /* Perform linking*/
-    Status link_ok = link(instruction_list, loc, symbol_set);
+    Status link_ok = link(instruction_list, loc, symbol_set, &diag);
+    diagFlush(&diag);
     printStatus(&link_ok, "LINKING");
     if (link_ok.code == OK) {
-        Status write_ok = writeInstructionsToFile(instruction_list, out_path, formatter);
+        Status write_ok = writeInstructionsToFile(instruction_list, out_path, &format, write_mode);
         printStatus(&write_ok, "WRITE TO FILE");
         if (write_ok.code != OK) {
             goto cleanup;
@@ -171,5 +414,9 @@ cleanup:
     deallocHashMap(instruction_set);
     deallocHashMap(symbol_set);
     deallocTokenList(&tl);
-    exit(EXIT_SUCCESS);
+    deallocLinkerScript(&script);
+    deallocLibrarySet(&libraries);
+    diagFree(&diag);
+    free(banked);
+    exit(exit_status);
 }
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "io.h"
+#include "linker.h"
+
+#define ALIGN4(n) (((n) + 3u) & ~(size_t)3u)
+
+/* Words coming from objects are already encoded, the definition only marks the entry as used */
+static InstructionDefinition raw_word_def = {.mask = 0, .arg_type = NO_ARG};
+
+/* Pointers into a mapped object, every section is used in place */
+typedef struct {
+    const char *path;
+    const ObjHeader *header;
+    const uint16_t *words;
+    const ObjSymbol *symbols;
+    const ObjReloc *relocs;
+    const char *strtab;
+    uint16_t base; /* Address of the first word in the linked program */
+} ObjView;
+
+/* Value stored in the global symbol table of the link step */
+typedef struct {
+    uint16_t addr;
+    uint16_t obj;
+} ObjExport;
+
+size_t objectSize(uint16_t word_count, uint16_t symbol_count, uint16_t reloc_count, uint32_t strtab_size) {
+    return sizeof(ObjHeader) + ALIGN4(word_count * sizeof(uint16_t)) + symbol_count * sizeof(ObjSymbol) + reloc_count * sizeof(ObjReloc) + strtab_size;
+}
+
+/* Append a NUL terminated string to the string table and return its offset */
+uint32_t pushObjString(char *strtab, uint32_t *strtab_size, const char *str) {
+    uint32_t offset = *strtab_size;
+    size_t len = strlen(str) + 1;
+    memcpy(strtab + offset, str, len);
+    *strtab_size += (uint32_t)len;
+    return offset;
+}
+
+/* Encode the program into a relocatable object. Every ADDR operand gets a relocation entry,
+    local labels are shifted by the object base at link time and unknown symbols are imported from other objects
+*/
+Status writeObjectFile(Instruction *instr_list, uint16_t instr_count, TokenList *tl, HashMap *sym_map, const char *f_name, WriteMode mode) {
+    if (instr_count > ROM_SIZE) {
+        return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "Object contains %u instructions, a ROM bank holds %u", instr_count, ROM_SIZE);
+    }
+
+    /* Size every section up front so the object is built in a single buffer */
+    uint16_t symbol_count = 0;
+    uint16_t reloc_count = 0;
+    size_t strtab_cap = 0;
+    for (SllNode *n = tl->list.head; n; n = n->next) {
+        TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
+        if (tn->tok.type == TOK_LABEL) {
+            symbol_count++;
+            strtab_cap += strlen(tn->tok.name) + 1;
+        }
+    }
+    for (uint16_t i = 0; i < instr_count; i++) {
+        if (instr_list[i].instruction && instr_list[i].instruction->arg_type == ADDR) {
+            reloc_count++;
+            strtab_cap += strlen(instr_list[i].arg1->tok.name) + 1;
+        }
+    }
+
+    uint8_t *buf = (uint8_t *)calloc(1, objectSize(instr_count, symbol_count, reloc_count, (uint32_t)strtab_cap));
+    if (!buf) {
+        return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "Error allocating object buffer");
+    }
+    ObjHeader *header = (ObjHeader *)buf;
+    uint16_t *words = (uint16_t *)(buf + sizeof(ObjHeader));
+    ObjSymbol *symbols = (ObjSymbol *)((uint8_t *)words + ALIGN4(instr_count * sizeof(uint16_t)));
+    ObjReloc *relocs = (ObjReloc *)(symbols + symbol_count);
+    char *strtab = (char *)(relocs + reloc_count);
+    uint32_t strtab_size = 0;
+
+    uint16_t sym_idx = 0;
+    for (SllNode *n = tl->list.head; n; n = n->next) {
+        TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
+        if (tn->tok.type != TOK_LABEL) {
+            continue;
+        }
+        uint16_t *loc = getPointerInHashMap(sym_map, tn->tok.name);
+        symbols[sym_idx++] = (ObjSymbol){
+            .name = pushObjString(strtab, &strtab_size, tn->tok.name),
+            .value = loc ? *loc : 0,
+            .flags = (tn->tok.value & LABEL_EXPORTED) ? OBJ_SYM_EXPORTED : 0};
+    }
+
+    uint16_t reloc_idx = 0;
+    for (uint16_t i = 0; i < instr_count; i++) {
+        Instruction *instr = &instr_list[i];
+        if (!instr->instruction || instr->instruction->arg_type != ADDR) {
+            Status res = encodeInstruction(instr, i, sym_map);
+            if (res.code != OK) {
+                free(buf);
+                return res;
+            }
+            words[i] = instr->raw;
+            continue;
+        }
+        uint16_t *loc = getPointerInHashMap(sym_map, instr->arg1->tok.name);
+        instr->raw = instr->instruction->mask;
+        words[i] = instr->raw;
+        relocs[reloc_idx++] = (ObjReloc){
+            .name = pushObjString(strtab, &strtab_size, instr->arg1->tok.name),
+            .word = i,
+            .kind = loc ? RELOC_LOCAL : RELOC_EXTERN,
+            .shift = instr->instruction->arg1_start,
+            .addend = loc ? *loc : 0};
+    }
+
+    memcpy(header->magic, OBJ_MAGIC, sizeof(header->magic));
+    header->version = OBJ_VERSION;
+    header->word_count = instr_count;
+    header->symbol_count = symbol_count;
+    header->reloc_count = reloc_count;
+    header->strtab_size = strtab_size;
+
+    Status res = writeFileAtomic(f_name, buf, objectSize(instr_count, symbol_count, reloc_count, strtab_size), mode);
+    free(buf);
+    return res;
+}
+
+/* Check the header of a mapped object, locate its sections and check every record against them:
+    names inside the string table, symbols and local relocation targets at most at the end of the words,
+    relocated words inside the object and address fields inside the word
+*/
+Status viewObject(ObjView *view, const MappedFile *mf, const char *path) {
+    view->path = path;
+    if (mf->size < sizeof(ObjHeader)) {
+        return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' is not an object file, too small", path);
+    }
+    const ObjHeader *header = (const ObjHeader *)mf->data;
+    if (memcmp(header->magic, OBJ_MAGIC, sizeof(header->magic)) != 0 || header->version != OBJ_VERSION) {
+        return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' is not a version %u object file", path, OBJ_VERSION);
+    }
+    if (objectSize(header->word_count, header->symbol_count, header->reloc_count, header->strtab_size) != mf->size ||
+        (header->strtab_size > 0 && mf->data[mf->size - 1] != '\0')) {
+        return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' is truncated or corrupted", path);
+    }
+    view->header = header;
+    view->words = (const uint16_t *)(mf->data + sizeof(ObjHeader));
+    view->symbols = (const ObjSymbol *)((const uint8_t *)view->words + ALIGN4(header->word_count * sizeof(uint16_t)));
+    view->relocs = (const ObjReloc *)(view->symbols + header->symbol_count);
+    view->strtab = (const char *)(view->relocs + header->reloc_count);
+    for (uint16_t s = 0; s < header->symbol_count; s++) {
+        const ObjSymbol *sym = &view->symbols[s];
+        if (sym->name >= header->strtab_size) {
+            return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' has a symbol name outside of its string table", path);
+        }
+        if (sym->value > header->word_count) {
+            return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' has a symbol at %u, past its %u words", path, sym->value, header->word_count);
+        }
+    }
+    for (uint16_t r = 0; r < header->reloc_count; r++) {
+        const ObjReloc *reloc = &view->relocs[r];
+        if (reloc->name >= header->strtab_size || reloc->word >= header->word_count || reloc->shift > 8 ||
+            (reloc->kind != RELOC_LOCAL && reloc->kind != RELOC_EXTERN) ||
+            (reloc->kind == RELOC_LOCAL && reloc->addend > header->word_count)) {
+            return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "'%s' has a relocation outside of the object", path);
+        }
+    }
+    return (Status){.code = OK};
+}
+
+/* Place the objects one after another in command line order, then resolve their relocations
+    The records were checked by viewObject. Symbol errors are reported to the sink while the objects are still mapped, since the names live inside them
+*/
+Status resolveObjects(Instruction *instr_list, uint16_t *instr_count, ObjView *views, int view_count, HashMap *exports, DiagSink *sink) {
+    StatusCode first_error = OK;
+    unsigned error_count = 0;
+    uint32_t total = 0;
+    for (int o = 0; o < view_count; o++) {
+        views[o].base = (uint16_t)total;
+        total += views[o].header->word_count;
+        if (total > ROM_SIZE) {
+            return makeStatus(ERR_LINK_ADDR_RANGE, NO_POS, NO_POS, "Linked program reaches %u instructions at '%s', a ROM bank holds %u", total, views[o].path, ROM_SIZE);
+        }
+        for (uint16_t s = 0; s < views[o].header->symbol_count; s++) {
+            const ObjSymbol *sym = &views[o].symbols[s];
+            const char *name = views[o].strtab + sym->name;
+            if (!(sym->flags & OBJ_SYM_EXPORTED)) {
+                continue;
+            }
+            ObjExport *prev = getPointerInHashMap(exports, name);
+            if (prev) {
+                Status dup = makeStatus(ERR_OBJ_DUP_SYMBOL, NO_POS, NO_POS, "Symbol '%s' is exported by both '%s' and '%s'", name, views[prev->obj].path, views[o].path);
+                diagReport(sink, &dup, "LINKING OBJECTS");
+                first_error = error_count++ ? first_error : dup.code;
+                continue;
+            }
+            ObjExport exp = {.addr = views[o].base + sym->value, .obj = (uint16_t)o};
+            if (!insertHashMap(exports, name, &exp, sizeof(ObjExport))) {
+                return makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "Failed insertion of an exported symbol of '%s'", views[o].path);
+            }
+        }
+    }
+
+    for (int o = 0; o < view_count; o++) {
+        const ObjView *view = &views[o];
+        Instruction *out = &instr_list[view->base];
+        for (uint16_t w = 0; w < view->header->word_count; w++) {
+            out[w] = (Instruction){.instruction = &raw_word_def, .raw = view->words[w]};
+        }
+        for (uint16_t r = 0; r < view->header->reloc_count; r++) {
+            const ObjReloc *reloc = &view->relocs[r];
+            const char *name = view->strtab + reloc->name;
+            Status res = {.code = OK};
+            uint16_t addr = 0;
+            if (reloc->kind == RELOC_LOCAL) {
+                addr = view->base + reloc->addend;
+            } else {
+                ObjExport *exp = getPointerInHashMap(exports, name);
+                if (!exp) {
+                    res = makeStatus(ERR_LINK_SYMBOL_UNDEFINED, NO_POS, NO_POS, "Undefined symbol '%s' referenced by '%s'. Not exported by any object", name, view->path);
+                } else {
+                    addr = exp->addr;
+                }
+            }
+            if (res.code == OK && addr > UINT8_MAX) {
+                res = makeStatus(ERR_LINK_ADDR_RANGE, NO_POS, NO_POS, "Symbol '%s' referenced by '%s' at address %u does not fit in 8 bits", name, view->path, addr);
+            }
+            if (res.code != OK) {
+                diagReport(sink, &res, "LINKING OBJECTS");
+                first_error = error_count++ ? first_error : res.code;
+                continue;
+            }
+            out[reloc->word].raw |= (uint16_t)(addr << reloc->shift);
+        }
+    }
+    *instr_count = (uint16_t)total;
+    if (error_count) {
+        return makeStatus(first_error, NO_POS, NO_POS, "%u symbol error(s) while linking objects", error_count);
+    }
+    return (Status){.code = OK};
+}
+
+/* Link relocatable objects into a single program. The objects are mapped and read in place */
+Status linkObjectFiles(Instruction *instr_list, uint16_t *instr_count, const char **paths, int path_count, DiagSink *sink) {
+    MappedFile *files = (MappedFile *)calloc((size_t)path_count, sizeof(MappedFile));
+    ObjView *views = (ObjView *)calloc((size_t)path_count, sizeof(ObjView));
+    HashMap *exports = NULL;
+    Status res = {.code = OK};
+    if (!files || !views) {
+        res = makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "Error allocating link state");
+    }
+
+    for (int o = 0; o < path_count && res.code == OK; o++) {
+        res = mapFile(&files[o], paths[o]);
+        if (res.code == OK) {
+            res = viewObject(&views[o], &files[o], paths[o]);
+        }
+    }
+    if (res.code == OK && !allocHashMap(&exports, HASH_MAP_BUCKETS)) {
+        res = makeStatus(ERR_OBJ_FORMAT, NO_POS, NO_POS, "Error allocating export hash map");
+    }
+    if (res.code == OK) {
+        res = resolveObjects(instr_list, instr_count, views, path_count, exports, sink);
+    }
+
+    for (int o = 0; files && o < path_count; o++) {
+        unmapFile(&files[o]);
+    }
+    if (exports) {
+        deallocHashMap(exports);
+    }
+    free(files);
+    free(views);
+    return res;
+}
@@ -0,0 +1,271 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "outline.h"
+#include "linker.h"
+
+#define RETURN_DEF_COUNT 7
+
+/* Window of the program starting at an instruction, grouped by the hash of its encoded words */
+typedef struct {
+    uint32_t hash;
+    uint16_t start;
+} Window;
+
+/* Non-overlapping occurrences of one sequence, in program order */
+typedef struct {
+    uint16_t length;
+    uint16_t sites;
+    int saved;
+    uint16_t starts[MAX_PROGRAM_SIZE / 2];
+} Candidate;
+
+typedef struct {
+    TokenList *tl;
+    HashMap *sym_map;
+    Instruction *instr_list;
+    uint16_t count;
+    uint16_t code_end; /* Outlined routines are appended from here on, they are never searched again */
+
+    InstructionDefinition *call_def;
+    InstructionDefinition *jmp_def;
+    /* RET, RETZ, RETNZ, RETC, RETNC, RETE, RETD: they pop the stack, so they must stay where they are */
+    InstructionDefinition *return_defs[RETURN_DEF_COUNT];
+
+    uint16_t words[MAX_PROGRAM_SIZE];        /* Encoded instructions, sequences are compared on these */
+    uint16_t barriers[MAX_PROGRAM_SIZE + 1]; /* Prefix counts of instructions which can not be outlined */
+    uint16_t labels[MAX_PROGRAM_SIZE + 1];   /* Prefix counts of instructions a label points at */
+    uint32_t hashes[MAX_PROGRAM_SIZE];       /* Hash of the window starting at every instruction, grown one word per length */
+    Window windows[MAX_PROGRAM_SIZE];
+    Candidate best;
+    Candidate current;
+    uint16_t remap[MAX_PROGRAM_SIZE + 1];
+    Instruction scratch[MAX_PROGRAM_SIZE + 1];
+} OutlineContext;
+
+Status lookupOutlineDefinitions(OutlineContext *ctx, HashMap *inst_map) {
+    static const char *return_names[RETURN_DEF_COUNT] = {"RET", "RETZ", "RETNZ", "RETC", "RETNC", "RETE", "RETD"};
+
+    ctx->call_def = getPointerInHashMap(inst_map, "CALL");
+    ctx->jmp_def = getPointerInHashMap(inst_map, "JMP");
+    bool found = ctx->call_def && ctx->jmp_def;
+    for (size_t i = 0; i < RETURN_DEF_COUNT; i++) {
+        ctx->return_defs[i] = getPointerInHashMap(inst_map, return_names[i]);
+        found = found && ctx->return_defs[i];
+    }
+    if (!found) {
+        return makeStatus(ERR_OUTLINE_INTERNAL, NO_POS, NO_POS, "Instruction set is missing the instructions used by outlining");
+    }
+    return (Status){.code = OK};
+}
+
+bool isReturnDefinition(const OutlineContext *ctx, const InstructionDefinition *def) {
+    for (size_t i = 0; i < RETURN_DEF_COUNT; i++) {
+        if (ctx->return_defs[i] == def) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Control flow and data stay in place: a jump or call inside a routine would target or push the wrong address,
+   a return would pop the routine's own return address, and data words are not code */
+bool isOutlineBarrier(const OutlineContext *ctx, const Instruction *instr) {
+    const InstructionDefinition *def = instr->instruction;
+    return !def || def->arg_type == ADDR || def->arg_type == DATA || isReturnDefinition(ctx, def);
+}
+
+/* Encode the searchable part of the program and index its barriers and label targets */
+void indexProgram(OutlineContext *ctx) {
+    memset(ctx->labels, 0, sizeof(ctx->labels));
+    for (size_t i = 0; i < ctx->sym_map->capacity; i++) {
+        Slot *slot = &ctx->sym_map->slots[i];
+        if (slot->key) {
+            uint16_t loc = *(uint16_t *)slot->value;
+            if (loc < ctx->code_end) {
+                ctx->labels[loc + 1] = 1;
+            }
+        }
+    }
+    ctx->barriers[0] = 0;
+    for (uint16_t i = 0; i < ctx->code_end; i++) {
+        Instruction copy = ctx->instr_list[i];
+        bool barrier = isOutlineBarrier(ctx, &copy) || encodeInstruction(&copy, i, ctx->sym_map).code != OK;
+        ctx->words[i] = barrier ? 0 : copy.raw;
+        ctx->barriers[i + 1] = ctx->barriers[i] + barrier;
+        ctx->labels[i + 1] += ctx->labels[i];
+    }
+}
+
+int compareWindows(const void *a, const void *b) {
+    const Window *x = (const Window *)a;
+    const Window *y = (const Window *)b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Words saved by replacing every site with a CALL and adding a single copy followed by RET */
+int outlineSavings(uint16_t length, uint16_t sites) {
+    return (int)sites * length - (sites + length + 1);
+}
+
+/* Find the repeated sequence saving the most words. Windows of every length are hashed incrementally,
+   sorted so equal sequences end up next to each other, and every group is checked word by word */
+void findBestCandidate(OutlineContext *ctx) {
+    ctx->best.saved = 0;
+    for (uint16_t i = 0; i < ctx->code_end; i++) {
+        ctx->hashes[i] = FNV_OFFSET;
+    }
+    for (uint16_t length = 1; length <= OUTLINE_MAX_LENGTH && length <= ctx->code_end; length++) {
+        uint16_t window_count = 0;
+        for (uint16_t start = 0; start + length <= ctx->code_end; start++) {
+            ctx->hashes[start] = (ctx->hashes[start] ^ ctx->words[start + length - 1]) * FNV_PRIME;
+            /* A label may only point at the first instruction, the CALL replacing the sequence takes it over */
+            if (length < 2 || ctx->barriers[start + length] != ctx->barriers[start] || ctx->labels[start + length] != ctx->labels[start + 1]) {
+                continue;
+            }
+            ctx->windows[window_count++] = (Window){.hash = ctx->hashes[start], .start = start};
+        }
+        if (window_count < 2) {
+            continue;
+        }
+        qsort(ctx->windows, window_count, sizeof(Window), compareWindows);
+
+        for (uint16_t g = 0; g < window_count;) {
+            uint16_t group_end = g + 1;
+            while (group_end < window_count && ctx->windows[group_end].hash == ctx->windows[g].hash) {
+                group_end++;
+            }
+            if (group_end - g >= 2) {
+                Candidate *c = &ctx->current;
+                const uint16_t *leader = &ctx->words[ctx->windows[g].start];
+                c->length = length;
+                c->sites = 0;
+                uint16_t free_from = 0;
+                for (uint16_t w = g; w < group_end; w++) {
+                    uint16_t start = ctx->windows[w].start;
+                    if (start >= free_from && !memcmp(&ctx->words[start], leader, length * sizeof(uint16_t))) {
+                        c->starts[c->sites++] = start;
+                        free_from = start + length;
+                    }
+                }
+                c->saved = outlineSavings(length, c->sites);
+                if (c->saved > ctx->best.saved) {
+                    ctx->best.length = c->length;
+                    ctx->best.sites = c->sites;
+                    ctx->best.saved = c->saved;
+                    memcpy(ctx->best.starts, c->starts, c->sites * sizeof(uint16_t));
+                }
+            }
+            g = group_end;
+        }
+    }
+}
+
+/* Replace every site of the best candidate with a CALL and append the routine after the program */
+Status applyBestCandidate(OutlineContext *ctx, OutlinedRoutine *routine, uint16_t index) {
+    const Candidate *c = &ctx->best;
+    /* Spaces can never appear in a lexed symbol, so these names cannot clash with user labels */
+    char name[32];
+    snprintf(name, sizeof(name), "outline %u", index);
+    tokenListPushBack(ctx->tl, (Token){.name = tokenListDup(ctx->tl, name), .type = TOK_MNEMONIC, .value = 0, .line = 0, .col = 0});
+    TokenNode *target = CONTAINER_OF(ctx->tl->list.tail, TokenNode, link);
+
+    uint16_t out = 0;
+    uint16_t site = 0;
+    for (uint16_t i = 0; i < ctx->count;) {
+        if (site < c->sites && c->starts[site] == i) {
+            for (uint16_t k = 0; k < c->length; k++) {
+                ctx->remap[i + k] = out;
+            }
+            ctx->scratch[out++] = (Instruction){.instruction = ctx->call_def, .arg1 = target};
+            i += c->length;
+            site++;
+            continue;
+        }
+        ctx->remap[i] = out;
+        ctx->scratch[out++] = ctx->instr_list[i++];
+    }
+    ctx->remap[ctx->count] = out;
+
+    uint16_t addr = out;
+    memcpy(&ctx->scratch[out], &ctx->instr_list[c->starts[0]], c->length * sizeof(Instruction));
+    out += c->length;
+    ctx->scratch[out++] = (Instruction){.instruction = ctx->return_defs[0]};
+
+    for (size_t i = 0; i < ctx->sym_map->capacity; i++) {
+        Slot *slot = &ctx->sym_map->slots[i];
+        if (slot->key) {
+            uint16_t *loc = (uint16_t *)slot->value;
+            *loc = ctx->remap[*loc];
+        }
+    }
+    if (!insertHashMap(ctx->sym_map, target->tok.name, &addr, sizeof(uint16_t))) {
+        return makeStatus(ERR_OUTLINE_INTERNAL, NO_POS, NO_POS, "Failed insertion of symbol '%s' into the symbol table", target->tok.name);
+    }
+
+    memcpy(ctx->instr_list, ctx->scratch, out * sizeof(Instruction));
+    memset(&ctx->instr_list[out], 0, (ctx->count - out) * sizeof(Instruction));
+    ctx->count = out;
+    ctx->code_end -= c->sites * (c->length - 1);
+    *routine = (OutlinedRoutine){.label = target->tok.name, .addr = addr, .length = c->length, .sites = c->sites};
+    return (Status){.code = OK};
+}
+
+/* Outline repeated instruction sequences into subroutines, the program must not be linked yet.
+   Every occurrence becomes a CALL and the routines are appended after the program, labels are moved accordingly */
+Status outlineProgram(OutlineReport *report, TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count) {
+    memset(report, 0, sizeof(*report));
+    report->words_before = report->words_after = *instr_count;
+    OutlineContext *ctx = (OutlineContext *)calloc(1, sizeof(OutlineContext));
+    if (!ctx) {
+        return makeStatus(ERR_OUTLINE_INTERNAL, NO_POS, NO_POS, "Error allocating outlining context");
+    }
+    ctx->tl = tl;
+    ctx->sym_map = sym_map;
+    ctx->instr_list = instr_list;
+    ctx->count = ctx->code_end = *instr_count;
+
+    Status res = lookupOutlineDefinitions(ctx, inst_map);
+    if (res.code == OK && ctx->count > 0) {
+        /* Routines are placed after the last instruction, so execution must never run past it */
+        const InstructionDefinition *last = instr_list[ctx->count - 1].instruction;
+        if (!last || (last != ctx->jmp_def && last != ctx->return_defs[0] && last != ctx->return_defs[5] && last != ctx->return_defs[6] && last->arg_type != DATA)) {
+            report->skipped = "the program does not end with JMP, RET, RETE, RETD or data, code could run into the routines";
+        }
+    }
+    while (res.code == OK && !report->skipped && report->routine_count < MAX_OUTLINED) {
+        indexProgram(ctx);
+        findBestCandidate(ctx);
+        if (ctx->best.saved <= 0) {
+            break;
+        }
+        res = applyBestCandidate(ctx, &report->routines[report->routine_count], report->routine_count);
+        report->routine_count += res.code == OK;
+    }
+    /* Later routines moved the earlier ones, read their final address back */
+    for (uint16_t i = 0; i < report->routine_count; i++) {
+        report->routines[i].addr = *(uint16_t *)getPointerInHashMap(sym_map, report->routines[i].label);
+    }
+    *instr_count = report->words_after = ctx->count;
+    free(ctx);
+    return res;
+}
+
+/* Print the routines created by outlining with the words they save and the instructions they add */
+void printOutlineReport(const OutlineReport *report) {
+    if (report->skipped) {
+        fprintf(stdout, "[OUTLINE]: Nothing outlined, %s\n", report->skipped);
+        return;
+    }
+    for (uint16_t i = 0; i < report->routine_count; i++) {
+        const OutlinedRoutine *r = &report->routines[i];
+        fprintf(stdout, "[OUTLINE]: %u instructions at %u, called from %u sites: saves %d words, every site executes %u extra instructions (CALL + RET) and needs one more stack level\n",
+                r->length, r->addr, r->sites, outlineSavings(r->length, r->sites), OUTLINE_SITE_OVERHEAD);
+    }
+    fprintf(stdout, "[OUTLINE]: %u routine(s), %u -> %u words (%u saved)\n",
+            report->routine_count, report->words_before, report->words_after, report->words_before - report->words_after);
+}
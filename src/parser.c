@@ -1,15 +1,18 @@
 #include "parser.h"
 #include "status.h"
 #include "token_list.h"
+#include "io.h"
 #include <stdio.h>
+#include <string.h>
+
+/* Words placed by DW / INCBIN are already encoded, the definition only marks the entry as used */
+static InstructionDefinition data_word_def = {.mask = 0, .arg_type = DATA};
 
 /* Try to consume the expected args for a given instruction and throw errors if the expected types do not match */
 Status consumeArgs(HashMap *instr_list, InstructionDefinition *def, SllNode *mnemonic_node, SllNode **next, Instruction *out) {
     SllNode *curr = mnemonic_node->next;
     if (!def) {
-        return (Status){
-            .code = ERR_PARSE_INTERNAL,
-            .message = "Missing instruction definition"};
+        return makeStatus(ERR_PARSE_INTERNAL, NO_POS, NO_POS, "Missing instruction definition");
     }
 
     TokenNode *arg1 = NULL;
@@ -110,22 +113,119 @@ Status consumeArgs(HashMap *instr_list, InstructionDefinition *def, SllNode *mne
         out->arg2 = arg2;
         *next = curr->next->next;
         return (Status){.code = OK};
+
+    case DATA: /* Placed by the DW / INCBIN directives, never an instruction */
+        break;
     }
     return makeStatus(ERR_PARSE_INTERNAL, NO_POS, NO_POS, "Internal error");
 }
 
-Status parseTokenList(TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *loc_count) {
+/* Decode the values of a DW directive straight into the image. Values are written like immediates (!d, !b or 0) but span 16 bits
+    The data of a directive must fit a ROM bank, labels into it are 8-bit addresses. Whether the whole program fits is
+    checked when it is linked or banked
+*/
+Status placeDataWords(const Token *tok, Instruction *instr_list, uint16_t *loc_counter) {
+    uint16_t loc = *loc_counter;
+    uint8_t col = tok->col;
+    Status res = {.code = OK};
+    for (const char *p = tok->name + strspn(tok->name, " ,\t"); *p && res.code == OK; p += strspn(p, " ,\t")) {
+        size_t len = strcspn(p, " ,\t");
+        col++;
+        uint32_t value = 0;
+        unsigned base = (len > 2 && p[0] == '!') ? (p[1] == 'd' ? 10 : p[1] == 'b' ? 2 : 0) : 0;
+        if (len == 1 && p[0] == '0') {
+            base = 10;
+        } else if (base == 0) {
+            res = makeStatus(ERR_PARSE_DATA, tok->line, col, "Bad data value. Use !d or !b followed by the value");
+        }
+        for (size_t i = (len == 1) ? 0 : 2; i < len && res.code == OK; i++) {
+            unsigned digit = (unsigned)(p[i] - '0');
+            value = value * base + digit;
+            if (digit >= base) {
+                res = makeStatus(ERR_PARSE_DATA, tok->line, col, "Bad data value, '%c' is not a base %u digit", p[i], base);
+            } else if (value > UINT16_MAX) {
+                res = makeStatus(ERR_PARSE_DATA, tok->line, col, "Data value out of bounds, maximum is %u", UINT16_MAX);
+            }
+        }
+        if (res.code == OK && loc - *loc_counter >= ROM_SIZE) {
+            res = makeStatus(ERR_PARSE_DATA, tok->line, col, "Data does not fit in ROM, a ROM bank holds %u words", ROM_SIZE);
+        } else if (res.code == OK && loc >= MAX_PROGRAM_SIZE) {
+            res = makeStatus(ERR_PARSE_DATA, tok->line, col, "Data does not fit in ROM, the program is limited to %u words", MAX_PROGRAM_SIZE);
+        }
+        if (res.code == OK) {
+            instr_list[loc++] = (Instruction){.instruction = &data_word_def, .raw = (uint16_t)value};
+        }
+        p += len;
+    }
+    if (res.code != OK) { /* Leave no partial data behind */
+        memset(&instr_list[*loc_counter], 0, (size_t)(loc - *loc_counter) * sizeof(Instruction));
+        return res;
+    }
+    *loc_counter = loc;
+    return res;
+}
+
+/* Copy a binary file into the image, read as big-endian 16-bit words straight from its mapping
+    Every image word is an Instruction the later passes index by address, so the words are converted rather than
+    referenced in the mapping; it is released right after
+*/
+Status placeBinaryFile(const Token *tok, Instruction *instr_list, uint16_t *loc_counter) {
+    MappedFile mf;
+    Status res = mapFile(&mf, tok->name);
+    if (res.code != OK) {
+        res.line = tok->line;
+        res.col = tok->col;
+        return res;
+    }
+    size_t count = mf.size / 2;
+    if (mf.size % 2 != 0) {
+        res = makeStatus(ERR_PARSE_DATA, tok->line, tok->col, "'%s' holds an odd number of bytes, expected 16-bit words", tok->name);
+    } else if (count > ROM_SIZE) {
+        res = makeStatus(ERR_PARSE_DATA, tok->line, tok->col, "'%s' holds %u words, a ROM bank holds %u", tok->name, (unsigned)count, ROM_SIZE);
+    } else if (count > (size_t)(MAX_PROGRAM_SIZE - *loc_counter)) {
+        res = makeStatus(ERR_PARSE_DATA, tok->line, tok->col, "'%s' holds %u words, only %u more fit in ROM", tok->name, (unsigned)count, MAX_PROGRAM_SIZE - *loc_counter);
+    } else {
+        Instruction *out = &instr_list[*loc_counter];
+        for (size_t i = 0; i < count; i++) {
+            out[i] = (Instruction){.instruction = &data_word_def, .raw = (uint16_t)(mf.data[2 * i] << 8 | mf.data[2 * i + 1])};
+        }
+        *loc_counter += (uint16_t)count;
+    }
+    unmapFile(&mf);
+    return res;
+}
+
+/* Skip the tokens of a malformed statement, up to the next label or instruction */
+SllNode *skipStatement(HashMap *inst_map, SllNode *n) {
+    while (n) {
+        TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
+        if (tn->tok.type == TOK_LABEL || tn->tok.type == TOK_DIRECTIVE || (tn->tok.type == TOK_MNEMONIC && getPointerInHashMap(inst_map, tn->tok.name))) {
+            break;
+        }
+        n = n->next;
+    }
+    return n;
+}
+
+/* Parse the token list into instructions and fill the symbol table with the label locations
+    Instructions are placed after the *loc_count ones already in the list, so several sources can share one image
+    With a sink every error is reported and parsing resumes at the next statement, without one it stops at the first error
+*/
+Status parseTokenList(TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *loc_count, DiagSink *sink) {
     if (!tl->list.head) {
         return makeStatus(ERR_PARSE_INTERNAL, 0, 0, "No tokens (source file empty)");
     }
 
     /* Start parsing each token one by one*/
-    uint8_t loc_counter = 0;
+    uint16_t loc_counter = *loc_count;
+    StatusCode first_error = OK;
+    unsigned error_count = 0;
     for (SllNode *n = tl->list.head; n;) {
         TokenNode *tn = CONTAINER_OF(n, TokenNode, link);
-        if (loc_counter > UINT8_MAX) {
-            return makeStatus(ERR_PARSE_INTERNAL, NO_POS, NO_POS, "Program contains more than 255 instructions");
+        if (loc_counter >= MAX_PROGRAM_SIZE) {
+            return makeStatus(ERR_PARSE_INTERNAL, NO_POS, NO_POS, "Program contains more than %u instructions", MAX_PROGRAM_SIZE);
         }
+        Status res = {.code = OK};
         switch (tn->tok.type) {
         case TOK_MNEMONIC: {
             InstructionDefinition *def = getPointerInHashMap(inst_map, tn->tok.name);
@@ -137,34 +237,57 @@ Status parseTokenList(TokenList *tl, HashMap *inst_map, HashMap *sym_map, Instru
             /* It is an instruction, so now handle the building of a new instruction and and update loc_counter */
             instr_list[loc_counter].instruction = def;
             SllNode *next = NULL;
-            Status res = consumeArgs(inst_map, def, n, &next, &instr_list[loc_counter]);
+            res = consumeArgs(inst_map, def, n, &next, &instr_list[loc_counter]);
             if (res.code != OK) {
-                *loc_count = loc_counter;
                 /* Populate the line and col fields according to the instruction that called for arguments*/
-                if (res.line == res.col) { /* If an argument is missing just throw the token where the expected value was ommited*/
-                    return makeStatus(res.code, tn->tok.line, tn->tok.col, "At '%s': %s", tn->tok.name, res.message);
-                } else { /* Else, print the actual column where the arg is missmatched */
-                    return makeStatus(res.code, tn->tok.line, res.col, "At '%s': %s", tn->tok.name, res.message);
-                }
+                setStatusAt(&res, tn->tok.name);
+                res.col = (res.line == res.col) ? tn->tok.col : res.col; /* If an argument is missing just throw the token where the expected value was ommited, else the actual column where the arg is missmatched */
+                res.line = tn->tok.line;
+                instr_list[loc_counter].instruction = NULL;
+                n = skipStatement(inst_map, n->next);
+                break;
             }
             loc_counter++;
             n = next;
             break;
         }
         case TOK_LABEL: {
-            bool insertion_status = insertHashMap(sym_map, tn->tok.name, &loc_counter, sizeof(uint8_t));
-            if (!insertion_status) {
+            if (getPointerInHashMap(sym_map, tn->tok.name)) {
                 /* Do not allow duplicate entries as this would not make sense*/
-                return makeStatus(ERR_PARSE_DUP_SYMBOL, tn->tok.line, tn->tok.col, "Failed insertion of symbol %s into symbol table, symbol already exists", tn->tok.name);
+                res = makeStatus(ERR_PARSE_DUP_SYMBOL, tn->tok.line, tn->tok.col, "Failed insertion of symbol %s into symbol table, symbol already exists", tn->tok.name);
+            } else if (!insertHashMap(sym_map, tn->tok.name, &loc_counter, sizeof(uint16_t))) {
+                res = makeStatus(ERR_PARSE_SYMBOL_TABLE, tn->tok.line, tn->tok.col, "Failed insertion of symbol %s into symbol table, the table is full and could not grow", tn->tok.name);
+            }
+            n = n->next;
+            break;
+        }
+        case TOK_DIRECTIVE: {
+            bool is_dw = tn->tok.value == DIRECTIVE_DW;
+            res = is_dw ? placeDataWords(&tn->tok, instr_list, &loc_counter) : placeBinaryFile(&tn->tok, instr_list, &loc_counter);
+            if (res.code != OK) {
+                setStatusAt(&res, is_dw ? "DW" : "INCBIN");
             }
             n = n->next;
             break;
         }
         default: {
-            return makeStatus(ERR_PARSE_INTERNAL, tn->tok.line, tn->tok.col, "Internal error, Unrecognized symbol: %s", CONTAINER_OF(n, TokenNode, link)->tok.name);
+            res = makeStatus(ERR_PARSE_INTERNAL, tn->tok.line, tn->tok.col, "Internal error, Unrecognized symbol: %s", tn->tok.name);
+            n = skipStatement(inst_map, n->next);
+            break;
+        }
         }
+        if (res.code != OK) {
+            if (!sink) {
+                *loc_count = loc_counter;
+                return res;
+            }
+            diagReport(sink, &res, "PARSE");
+            first_error = error_count++ ? first_error : res.code;
         }
     }
     *loc_count = loc_counter;
+    if (error_count) {
+        return makeStatus(first_error, NO_POS, NO_POS, "%u parsing error(s)", error_count);
+    }
     return (Status){.code = OK};
-}
\ No newline at end of file
+}
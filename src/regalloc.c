@@ -0,0 +1,904 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "regalloc.h"
+#include "token.h"
+
+/* Values are numbered with the physical registers first, virtual register i is node PHYSICAL_REGS + i */
+#define ALLOC_NODES (PHYSICAL_REGS + MAX_VIRTUAL_REGS)
+#define SET_WORDS ((ALLOC_NODES + 63) / 64)
+#define NO_TARGET 0xFFFF
+#define NO_COLOR 0xFF
+#define CALL_DEF_COUNT 5
+#define RETURN_DEF_COUNT 5
+
+typedef struct {
+    uint64_t bits[SET_WORDS];
+} RegSet;
+
+/* Where execution goes after an instruction, calls are summarized by the routine they enter */
+typedef enum {
+    FLOW_NEXT,
+    FLOW_JUMP,
+    FLOW_BRANCH,
+    FLOW_CALL,
+    FLOW_CALL_COND,
+    FLOW_RETURN,
+    FLOW_RETURN_COND,
+    FLOW_EXIT
+} FlowKind;
+
+/* Code reached from a CALL target up to its returns. Values live across a call to it which it never writes
+   do not flow through it, they only have to avoid the registers it writes */
+typedef struct {
+    uint16_t entry;
+    RegSet mod;      /* Values written by the routine or the routines it calls */
+    RegSet ret_live; /* Values it writes which are read after one of its calls returns */
+} Routine;
+
+/* Pairs found while walking the routines: a return belonging to one, or a routine calling another */
+typedef struct {
+    uint16_t routine;
+    uint16_t idx;
+} RoutineLink;
+
+typedef struct {
+    RoutineLink *items;
+    size_t count;
+    size_t capacity;
+} RoutineLinks;
+
+typedef struct {
+    HashMap *sym_map;
+    HashMap *vreg_map; /* Virtual register name -> index */
+    Instruction *instr_list;
+    uint16_t count;
+    RegAllocReport *report;
+    DiagSink *sink;
+
+    InstructionDefinition *load_def;
+    InstructionDefinition *input_def;
+    InstructionDefinition *inputp_def;
+    InstructionDefinition *output_def;
+    InstructionDefinition *outputp_def;
+    InstructionDefinition *jmp_def;
+    InstructionDefinition *call_defs[CALL_DEF_COUNT];
+    InstructionDefinition *return_defs[RETURN_DEF_COUNT];
+    InstructionDefinition *rete_def;
+    InstructionDefinition *retd_def;
+
+    uint8_t flow[MAX_PROGRAM_SIZE];
+    uint16_t target[MAX_PROGRAM_SIZE];
+    RegSet use[MAX_PROGRAM_SIZE];
+    RegSet def[MAX_PROGRAM_SIZE];
+    RegSet live_in[MAX_PROGRAM_SIZE];
+    RegSet live_out[MAX_PROGRAM_SIZE];
+
+    Routine *routines;
+    uint16_t routine_count;
+    uint16_t routine_of[MAX_PROGRAM_SIZE]; /* Routine entered at an address, NO_TARGET when none */
+    RoutineLinks returns;                  /* idx: a return of the routine */
+    RoutineLinks callees;                  /* idx: a routine called from it */
+    uint16_t visited[MAX_PROGRAM_SIZE];
+    uint16_t worklist[MAX_PROGRAM_SIZE];
+    bool in_handler[MAX_PROGRAM_SIZE]; /* Instruction of an interrupt handler or of a routine it calls */
+    RegSet handler_values;             /* Virtual registers used by interrupt handler code */
+
+    /* Interference graph, physical nodes only record the virtual registers which can not take them */
+    RegSet adj[ALLOC_NODES];
+    uint16_t alias[ALLOC_NODES]; /* Node a coalesced node was merged into */
+    uint16_t hint[ALLOC_NODES];  /* Move partner, its register is preferred so the copy disappears */
+    uint8_t color[ALLOC_NODES];
+    uint16_t stack[ALLOC_NODES];
+    bool removed[ALLOC_NODES];
+    uint16_t remap[MAX_PROGRAM_SIZE + 1];
+} AllocContext;
+
+void regSetAdd(RegSet *s, uint16_t node) {
+    s->bits[node / 64] |= 1ull << (node % 64);
+}
+
+void regSetRemove(RegSet *s, uint16_t node) {
+    s->bits[node / 64] &= ~(1ull << (node % 64));
+}
+
+bool regSetHas(const RegSet *s, uint16_t node) {
+    return (s->bits[node / 64] >> (node % 64)) & 1;
+}
+
+unsigned countBits(uint64_t x) {
+    unsigned n = 0;
+    for (; x; x &= x - 1) {
+        n++;
+    }
+    return n;
+}
+
+unsigned regSetCount(const RegSet *s) {
+    unsigned n = 0;
+    for (size_t w = 0; w < SET_WORDS; w++) {
+        n += countBits(s->bits[w]);
+    }
+    return n;
+}
+
+/* dst |= src, returns whether dst changed */
+bool regSetUnion(RegSet *dst, const RegSet *src) {
+    uint64_t changed = 0;
+    for (size_t w = 0; w < SET_WORDS; w++) {
+        uint64_t merged = dst->bits[w] | src->bits[w];
+        changed |= merged ^ dst->bits[w];
+        dst->bits[w] = merged;
+    }
+    return changed != 0;
+}
+
+bool isVirtualRegister(const TokenNode *tn) {
+    return tn && tn->tok.type == TOK_REGISTER && (tn->tok.value & REGISTER_VIRTUAL);
+}
+
+Status lookupAllocDefinitions(AllocContext *ctx, HashMap *inst_map) {
+    static const char *call_names[CALL_DEF_COUNT] = {"CALL", "CALLZ", "CALLNZ", "CALLC", "CALLNC"};
+    static const char *return_names[RETURN_DEF_COUNT] = {"RET", "RETZ", "RETNZ", "RETC", "RETNC"};
+
+    ctx->load_def = getPointerInHashMap(inst_map, "LOAD");
+    ctx->input_def = getPointerInHashMap(inst_map, "INPUT");
+    ctx->inputp_def = getPointerInHashMap(inst_map, "INPUTP");
+    ctx->output_def = getPointerInHashMap(inst_map, "OUTPUT");
+    ctx->outputp_def = getPointerInHashMap(inst_map, "OUTPUTP");
+    ctx->jmp_def = getPointerInHashMap(inst_map, "JMP");
+    ctx->rete_def = getPointerInHashMap(inst_map, "RETE");
+    ctx->retd_def = getPointerInHashMap(inst_map, "RETD");
+    bool found = ctx->load_def && ctx->input_def && ctx->inputp_def && ctx->output_def && ctx->outputp_def && ctx->jmp_def && ctx->rete_def && ctx->retd_def;
+    for (size_t i = 0; i < CALL_DEF_COUNT; i++) {
+        ctx->call_defs[i] = getPointerInHashMap(inst_map, call_names[i]);
+        ctx->return_defs[i] = getPointerInHashMap(inst_map, return_names[i]);
+        found = found && ctx->call_defs[i] && ctx->return_defs[i];
+    }
+    if (!found) {
+        return makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Instruction set is missing the instructions used by register allocation");
+    }
+    return (Status){.code = OK};
+}
+
+/* Line of an instruction for diagnostics, taken from its operands or from the closest instruction before it */
+uint32_t instructionLine(const AllocContext *ctx, uint16_t idx) {
+    for (int i = idx; i >= 0; i--) {
+        const Instruction *instr = &ctx->instr_list[i];
+        if (instr->arg1) {
+            return instr->arg1->tok.line;
+        }
+    }
+    return NO_POS;
+}
+
+uint16_t nodeOf(const AllocContext *ctx, const TokenNode *tn) {
+    if (!isVirtualRegister(tn)) {
+        return tn->tok.value;
+    }
+    return PHYSICAL_REGS + *(uint16_t *)getPointerInHashMap(ctx->vreg_map, tn->tok.name);
+}
+
+/* Give every virtual register an index, in order of first use */
+Status numberVirtualRegisters(AllocContext *ctx) {
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        TokenNode *args[2] = {ctx->instr_list[i].arg1, ctx->instr_list[i].arg2};
+        for (size_t a = 0; a < 2; a++) {
+            if (!isVirtualRegister(args[a]) || getPointerInHashMap(ctx->vreg_map, args[a]->tok.name)) {
+                continue;
+            }
+            uint16_t idx = ctx->report->virtual_count;
+            if (idx >= MAX_VIRTUAL_REGS) {
+                return makeStatus(ERR_ALLOC_INTERNAL, args[a]->tok.line, args[a]->tok.col, "Too many virtual registers, maximum is %u", MAX_VIRTUAL_REGS);
+            }
+            if (!insertHashMap(ctx->vreg_map, args[a]->tok.name, &idx, sizeof(uint16_t))) {
+                return makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Failed insertion of virtual register '%s'", args[a]->tok.name);
+            }
+            ctx->report->mappings[idx] = (RegMapping){.name = args[a]->tok.name, .reg = NO_COLOR};
+            ctx->report->virtual_count++;
+        }
+    }
+    return (Status){.code = OK};
+}
+
+bool isDefinitionOf(const InstructionDefinition *def, InstructionDefinition *const *defs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (defs[i] == def) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Record the control flow of every instruction and the registers it reads and writes */
+void buildFlow(AllocContext *ctx) {
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        const Instruction *instr = &ctx->instr_list[i];
+        const InstructionDefinition *def = instr->instruction;
+        RegSet *use = &ctx->use[i];
+        RegSet *out = &ctx->def[i];
+        ctx->target[i] = NO_TARGET;
+        ctx->flow[i] = FLOW_NEXT;
+        if (!def || def->arg_type == DATA || def == ctx->rete_def || def == ctx->retd_def) {
+            ctx->flow[i] = FLOW_EXIT;
+            continue;
+        }
+        switch (def->arg_type) {
+        case ADDR: {
+            uint16_t *addr = getPointerInHashMap(ctx->sym_map, instr->arg1->tok.name);
+            ctx->target[i] = (addr && *addr < ctx->count) ? *addr : NO_TARGET;
+            bool is_call = isDefinitionOf(def, ctx->call_defs, CALL_DEF_COUNT);
+            if (def == ctx->jmp_def) {
+                ctx->flow[i] = FLOW_JUMP;
+            } else if (is_call) {
+                ctx->flow[i] = (def == ctx->call_defs[0]) ? FLOW_CALL : FLOW_CALL_COND;
+            } else {
+                ctx->flow[i] = FLOW_BRANCH;
+            }
+            break;
+        }
+        case NO_ARG:
+            if (def == ctx->return_defs[0]) {
+                ctx->flow[i] = FLOW_RETURN;
+            } else if (isDefinitionOf(def, ctx->return_defs, RETURN_DEF_COUNT)) {
+                ctx->flow[i] = FLOW_RETURN_COND;
+            }
+            break;
+        case REG: /* Shifts and rotates update their register */
+            regSetAdd(use, nodeOf(ctx, instr->arg1));
+            regSetAdd(out, nodeOf(ctx, instr->arg1));
+            break;
+        case REG_ANY:
+            if (def != ctx->load_def) {
+                regSetAdd(use, nodeOf(ctx, instr->arg1));
+            }
+            if (instr->arg2->tok.type == TOK_REGISTER) {
+                regSetAdd(use, nodeOf(ctx, instr->arg2));
+            }
+            regSetAdd(out, nodeOf(ctx, instr->arg1));
+            break;
+        case REG_REG: /* The second register holds the port */
+            regSetAdd(use, nodeOf(ctx, instr->arg2));
+            if (def == ctx->input_def) {
+                regSetAdd(out, nodeOf(ctx, instr->arg1));
+            } else {
+                regSetAdd(use, nodeOf(ctx, instr->arg1));
+            }
+            break;
+        case REG_IMM:
+            if (def == ctx->inputp_def) {
+                regSetAdd(out, nodeOf(ctx, instr->arg1));
+            } else {
+                regSetAdd(use, nodeOf(ctx, instr->arg1));
+            }
+            break;
+        case DATA:
+            break;
+        }
+    }
+}
+
+bool pushRoutineLink(RoutineLinks *links, uint16_t routine, uint16_t idx) {
+    if (links->count == links->capacity) {
+        size_t capacity = links->capacity ? 2 * links->capacity : 64;
+        RoutineLink *items = (RoutineLink *)realloc(links->items, capacity * sizeof(RoutineLink));
+        if (!items) {
+            return false;
+        }
+        links->items = items;
+        links->capacity = capacity;
+    }
+    links->items[links->count++] = (RoutineLink){.routine = routine, .idx = idx};
+    return true;
+}
+
+bool isCallTo(const AllocContext *ctx, uint16_t i) {
+    return (ctx->flow[i] == FLOW_CALL || ctx->flow[i] == FLOW_CALL_COND) && ctx->target[i] != NO_TARGET;
+}
+
+/* Walk every routine from its entry, a call inside it continues after the call. Collects the returns of every routine,
+   the routines it calls and the values it writes, then adds the writes of the callees until nothing changes */
+Status buildRoutines(AllocContext *ctx) {
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        ctx->routine_of[i] = NO_TARGET;
+    }
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        if (isCallTo(ctx, i) && ctx->routine_of[ctx->target[i]] == NO_TARGET) {
+            ctx->routine_of[ctx->target[i]] = ctx->routine_count++;
+        }
+    }
+    if (ctx->routine_count == 0) {
+        return (Status){.code = OK};
+    }
+    ctx->routines = (Routine *)calloc(ctx->routine_count, sizeof(Routine));
+    if (!ctx->routines) {
+        return makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Error allocating routine summaries");
+    }
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        if (ctx->routine_of[i] != NO_TARGET) {
+            ctx->routines[ctx->routine_of[i]].entry = i;
+        }
+    }
+
+    bool ok = true;
+    for (uint16_t r = 0; r < ctx->routine_count && ok; r++) {
+        Routine *routine = &ctx->routines[r];
+        uint16_t depth = 0;
+        ctx->worklist[depth++] = routine->entry;
+        ctx->visited[routine->entry] = r + 1;
+        while (depth > 0 && ok) {
+            uint16_t i = ctx->worklist[--depth];
+            uint16_t next[2] = {NO_TARGET, NO_TARGET};
+            regSetUnion(&routine->mod, &ctx->def[i]);
+            switch (ctx->flow[i]) {
+            case FLOW_NEXT:
+            case FLOW_CALL:
+            case FLOW_CALL_COND:
+                next[0] = i + 1;
+                if (isCallTo(ctx, i)) {
+                    ok = pushRoutineLink(&ctx->callees, r, ctx->routine_of[ctx->target[i]]);
+                }
+                break;
+            case FLOW_JUMP:
+                next[0] = ctx->target[i];
+                break;
+            case FLOW_BRANCH:
+                next[0] = ctx->target[i];
+                next[1] = i + 1;
+                break;
+            case FLOW_RETURN_COND:
+                next[0] = i + 1;
+                ok = pushRoutineLink(&ctx->returns, r, i);
+                break;
+            case FLOW_RETURN:
+                ok = pushRoutineLink(&ctx->returns, r, i);
+                break;
+            case FLOW_EXIT:
+                break;
+            }
+            for (size_t n = 0; n < 2; n++) {
+                if (next[n] < ctx->count && ctx->visited[next[n]] != r + 1) {
+                    ctx->visited[next[n]] = r + 1;
+                    ctx->worklist[depth++] = next[n];
+                }
+            }
+        }
+    }
+    if (!ok) {
+        return makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Error allocating routine links");
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t l = 0; l < ctx->callees.count; l++) {
+            const RoutineLink *link = &ctx->callees.items[l];
+            changed |= regSetUnion(&ctx->routines[link->routine].mod, &ctx->routines[link->idx].mod);
+        }
+    }
+    return (Status){.code = OK};
+}
+
+/* Interrupt handlers have no entry the allocator can see, the hardware enters them between any two instructions.
+   Handler code is every instruction from which a RETE / RETD can be reached, plus everything it branches or calls into */
+void markHandlerCode(AllocContext *ctx) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = ctx->count - 1; i >= 0; i--) {
+            const InstructionDefinition *def = ctx->instr_list[i].instruction;
+            bool reaches = def && (def == ctx->rete_def || def == ctx->retd_def);
+            uint16_t target = ctx->target[i];
+            bool has_next = i + 1 < ctx->count;
+            switch (ctx->flow[i]) {
+            case FLOW_NEXT:
+            case FLOW_CALL:
+            case FLOW_CALL_COND:
+            case FLOW_RETURN_COND:
+                reaches |= has_next && ctx->in_handler[i + 1];
+                break;
+            case FLOW_BRANCH:
+                reaches |= (has_next && ctx->in_handler[i + 1]) || (target != NO_TARGET && ctx->in_handler[target]);
+                break;
+            case FLOW_JUMP:
+                reaches |= target != NO_TARGET && ctx->in_handler[target];
+                break;
+            case FLOW_RETURN:
+            case FLOW_EXIT:
+                break;
+            }
+            if (reaches && !ctx->in_handler[i]) {
+                ctx->in_handler[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    uint16_t depth = 0;
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        if (ctx->in_handler[i]) {
+            ctx->worklist[depth++] = i;
+        }
+    }
+    while (depth > 0) {
+        uint16_t i = ctx->worklist[--depth];
+        regSetUnion(&ctx->handler_values, &ctx->use[i]);
+        regSetUnion(&ctx->handler_values, &ctx->def[i]);
+        uint16_t next[2] = {NO_TARGET, NO_TARGET};
+        if (ctx->flow[i] != FLOW_JUMP && ctx->flow[i] != FLOW_RETURN && ctx->flow[i] != FLOW_EXIT) {
+            next[0] = i + 1;
+        }
+        if (ctx->flow[i] != FLOW_NEXT && ctx->flow[i] != FLOW_RETURN_COND) {
+            next[1] = ctx->target[i];
+        }
+        for (size_t n = 0; n < 2; n++) {
+            if (next[n] < ctx->count && !ctx->in_handler[next[n]]) {
+                ctx->in_handler[next[n]] = true;
+                ctx->worklist[depth++] = next[n];
+            }
+        }
+    }
+    for (uint16_t p = 0; p < PHYSICAL_REGS; p++) {
+        regSetRemove(&ctx->handler_values, p);
+    }
+}
+
+/* Backward liveness over the control flow graph, iterated until nothing changes.
+   Returns only lead back to the calls of their own routines, carrying the values the routine hands back */
+void computeLiveness(AllocContext *ctx) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t l = 0; l < ctx->returns.count; l++) {
+            const RoutineLink *link = &ctx->returns.items[l];
+            changed |= regSetUnion(&ctx->live_out[link->idx], &ctx->routines[link->routine].ret_live);
+        }
+        for (int i = ctx->count - 1; i >= 0; i--) {
+            RegSet out = ctx->live_out[i];
+            bool has_next = i + 1 < ctx->count;
+            uint16_t target = ctx->target[i];
+            switch (ctx->flow[i]) {
+            case FLOW_NEXT:
+            case FLOW_RETURN_COND:
+                if (has_next) {
+                    regSetUnion(&out, &ctx->live_in[i + 1]);
+                }
+                break;
+            case FLOW_CALL:
+            case FLOW_CALL_COND:
+                if (target == NO_TARGET || ctx->flow[i] == FLOW_CALL_COND) {
+                    /* A call to a routine defined elsewhere is expected to leave the registers alone */
+                    if (has_next) {
+                        regSetUnion(&out, &ctx->live_in[i + 1]);
+                    }
+                }
+                if (target != NO_TARGET && has_next) {
+                    Routine *routine = &ctx->routines[ctx->routine_of[target]];
+                    RegSet handed_back = {0};
+                    for (size_t w = 0; w < SET_WORDS; w++) {
+                        out.bits[w] |= ctx->live_in[i + 1].bits[w] & ~routine->mod.bits[w];
+                        handed_back.bits[w] = ctx->live_in[i + 1].bits[w] & routine->mod.bits[w];
+                    }
+                    changed |= regSetUnion(&routine->ret_live, &handed_back);
+                }
+                if (target != NO_TARGET) {
+                    regSetUnion(&out, &ctx->live_in[target]);
+                }
+                break;
+            case FLOW_BRANCH:
+                if (has_next) {
+                    regSetUnion(&out, &ctx->live_in[i + 1]);
+                }
+                if (target != NO_TARGET) {
+                    regSetUnion(&out, &ctx->live_in[target]);
+                }
+                break;
+            case FLOW_JUMP:
+                if (target != NO_TARGET) {
+                    regSetUnion(&out, &ctx->live_in[target]);
+                }
+                break;
+            case FLOW_RETURN:
+            case FLOW_EXIT:
+                break;
+            }
+            RegSet in = out;
+            for (size_t w = 0; w < SET_WORDS; w++) {
+                in.bits[w] = ctx->use[i].bits[w] | (out.bits[w] & ~ctx->def[i].bits[w]);
+            }
+            changed |= regSetUnion(&ctx->live_out[i], &out);
+            changed |= regSetUnion(&ctx->live_in[i], &in);
+        }
+    }
+}
+
+/* Write the names of the values in a set, shortened to fit the buffer */
+void describeValues(const AllocContext *ctx, const RegSet *s, char *buf, size_t buf_size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (uint16_t n = 0; n < PHYSICAL_REGS + ctx->report->virtual_count; n++) {
+        if (!regSetHas(s, n)) {
+            continue;
+        }
+        char phys[8];
+        snprintf(phys, sizeof(phys), "%%%u", n);
+        const char *name = n < PHYSICAL_REGS ? phys : ctx->report->mappings[n - PHYSICAL_REGS].name;
+        if (len + strlen(name) + 6 >= buf_size) {
+            snprintf(buf + len, buf_size - len, "%s...", len ? ", " : "");
+            return;
+        }
+        len += (size_t)snprintf(buf + len, buf_size - len, "%s%s", len ? ", " : "", name);
+    }
+}
+
+/* Report every place where more values are live than there are registers to hold them */
+unsigned checkPressure(AllocContext *ctx, uint16_t reserved) {
+    unsigned error_count = 0;
+    bool over = false;
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        RegSet live = ctx->live_out[i];
+        regSetUnion(&live, &ctx->def[i]);
+        unsigned count = regSetCount(&live);
+        unsigned physical = countBits(live.bits[0] & 0xFFFF);
+        unsigned blocked = countBits(reserved & ~live.bits[0] & 0xFFFF);
+        if (count > ctx->report->max_live) {
+            ctx->report->max_live = (uint16_t)count;
+        }
+        bool now_over = count > physical && count + blocked > PHYSICAL_REGS;
+        if (now_over && !over) {
+            char names[160];
+            describeValues(ctx, &live, names, sizeof(names));
+            Status res = makeStatus(ERR_ALLOC_PRESSURE, instructionLine(ctx, i), NO_POS, "%u values live at once, only %u registers are free: %s",
+                                    count, PHYSICAL_REGS - blocked, names);
+            diagReport(ctx->sink, &res, "REGISTER ALLOCATION");
+            error_count++;
+        }
+        over = now_over;
+    }
+    return error_count;
+}
+
+void addInterference(AllocContext *ctx, uint16_t a, uint16_t b) {
+    if (a == b || (a < PHYSICAL_REGS && b < PHYSICAL_REGS)) {
+        return;
+    }
+    regSetAdd(&ctx->adj[a], b);
+    regSetAdd(&ctx->adj[b], a);
+}
+
+bool isMove(const AllocContext *ctx, const Instruction *instr) {
+    return instr->instruction == ctx->load_def && instr->arg2->tok.type == TOK_REGISTER &&
+           (isVirtualRegister(instr->arg1) || isVirtualRegister(instr->arg2));
+}
+
+/* A value written by an instruction interferes with everything live after it, except the source of a copy */
+void buildInterference(AllocContext *ctx, uint16_t reserved) {
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        const Instruction *instr = &ctx->instr_list[i];
+        bool move = isMove(ctx, instr);
+        uint16_t src = move ? nodeOf(ctx, instr->arg2) : NO_TARGET;
+        for (uint16_t d = 0; d < PHYSICAL_REGS + ctx->report->virtual_count; d++) {
+            if (!regSetHas(&ctx->def[i], d)) {
+                continue;
+            }
+            for (uint16_t v = 0; v < PHYSICAL_REGS + ctx->report->virtual_count; v++) {
+                if (v != src && regSetHas(&ctx->live_out[i], v)) {
+                    addInterference(ctx, d, v);
+                }
+            }
+        }
+        if (isCallTo(ctx, i) && i + 1 < ctx->count) {
+            /* Values kept across the call must avoid every register the routine writes */
+            const Routine *routine = &ctx->routines[ctx->routine_of[ctx->target[i]]];
+            for (uint16_t v = 0; v < PHYSICAL_REGS + ctx->report->virtual_count; v++) {
+                if (!regSetHas(&ctx->live_in[i + 1], v) || regSetHas(&routine->mod, v)) {
+                    continue;
+                }
+                for (uint16_t d = 0; d < PHYSICAL_REGS + ctx->report->virtual_count; d++) {
+                    if (regSetHas(&routine->mod, d)) {
+                        addInterference(ctx, v, d);
+                    }
+                }
+            }
+        }
+        if (move) {
+            uint16_t dst = nodeOf(ctx, instr->arg1);
+            ctx->hint[dst] = ctx->hint[dst] == NO_TARGET ? src : ctx->hint[dst];
+            ctx->hint[src] = ctx->hint[src] == NO_TARGET ? dst : ctx->hint[src];
+        }
+    }
+    for (uint16_t v = 0; v < ctx->report->virtual_count; v++) {
+        for (uint16_t p = 0; p < PHYSICAL_REGS; p++) {
+            if (reserved & (1u << p)) {
+                addInterference(ctx, PHYSICAL_REGS + v, p);
+            }
+        }
+    }
+    /* An interrupt may arrive while any value of the rest of the program is live, so handler values share no register
+       with them. Handlers do not interrupt each other, among themselves liveness decides as usual. When the program
+       entry runs into a handler the two can not be told apart, and no virtual registers share a register at all */
+    bool separate_all = ctx->count > 0 && ctx->in_handler[0];
+    for (uint16_t h = PHYSICAL_REGS; h < PHYSICAL_REGS + ctx->report->virtual_count; h++) {
+        if (!separate_all && !regSetHas(&ctx->handler_values, h)) {
+            continue;
+        }
+        for (uint16_t v = PHYSICAL_REGS; v < PHYSICAL_REGS + ctx->report->virtual_count; v++) {
+            if (separate_all || !regSetHas(&ctx->handler_values, v)) {
+                addInterference(ctx, h, v);
+            }
+        }
+    }
+}
+
+uint16_t findAlias(const AllocContext *ctx, uint16_t node) {
+    while (ctx->alias[node] != node) {
+        node = ctx->alias[node];
+    }
+    return node;
+}
+
+/* Physical registers count as neighbours nothing can be simplified around */
+bool isSignificant(const AllocContext *ctx, uint16_t node) {
+    return node < PHYSICAL_REGS || regSetCount(&ctx->adj[node]) >= PHYSICAL_REGS;
+}
+
+/* Merging only when the result is still colorable: Briggs for two virtual registers, George for a physical one */
+bool canCoalesce(const AllocContext *ctx, uint16_t x, uint16_t y) {
+    if (x < PHYSICAL_REGS) {
+        for (uint16_t t = PHYSICAL_REGS; t < PHYSICAL_REGS + ctx->report->virtual_count; t++) {
+            if (regSetHas(&ctx->adj[y], t) && !regSetHas(&ctx->adj[t], x) && isSignificant(ctx, t)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    RegSet merged = ctx->adj[x];
+    regSetUnion(&merged, &ctx->adj[y]);
+    unsigned significant = 0;
+    for (uint16_t t = 0; t < PHYSICAL_REGS + ctx->report->virtual_count; t++) {
+        significant += regSetHas(&merged, t) && isSignificant(ctx, t);
+    }
+    return significant < PHYSICAL_REGS;
+}
+
+/* Merge the two sides of register copies which never hold different values at the same time */
+void coalesceCopies(AllocContext *ctx) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint16_t i = 0; i < ctx->count; i++) {
+            const Instruction *instr = &ctx->instr_list[i];
+            if (!isMove(ctx, instr)) {
+                continue;
+            }
+            uint16_t x = findAlias(ctx, nodeOf(ctx, instr->arg1));
+            uint16_t y = findAlias(ctx, nodeOf(ctx, instr->arg2));
+            if (y < x) { /* Keep the physical register, if any, as the survivor */
+                uint16_t t = x;
+                x = y;
+                y = t;
+            }
+            if (x == y || y < PHYSICAL_REGS || regSetHas(&ctx->adj[x], y) || !canCoalesce(ctx, x, y)) {
+                continue;
+            }
+            for (uint16_t t = 0; t < PHYSICAL_REGS + ctx->report->virtual_count; t++) {
+                if (regSetHas(&ctx->adj[y], t)) {
+                    regSetRemove(&ctx->adj[t], y);
+                    addInterference(ctx, x, t);
+                }
+            }
+            memset(&ctx->adj[y], 0, sizeof(RegSet));
+            ctx->alias[y] = x;
+            changed = true;
+        }
+    }
+}
+
+uint8_t colorOf(const AllocContext *ctx, uint16_t node) {
+    node = findAlias(ctx, node);
+    return node < PHYSICAL_REGS ? (uint8_t)node : ctx->color[node];
+}
+
+/* Simplify and select: nodes with fewer neighbours than registers are set aside first, the others optimistically.
+   They are then colored in reverse order, preferring the register of a copy partner */
+unsigned colorGraph(AllocContext *ctx) {
+    uint16_t node_end = PHYSICAL_REGS + ctx->report->virtual_count;
+    uint16_t depth = 0;
+    for (;;) {
+        uint16_t pick = NO_TARGET;
+        unsigned pick_degree = 0;
+        for (uint16_t n = PHYSICAL_REGS; n < node_end; n++) {
+            if (ctx->removed[n] || ctx->alias[n] != n) {
+                continue;
+            }
+            unsigned degree = 0;
+            for (uint16_t t = 0; t < node_end; t++) {
+                degree += regSetHas(&ctx->adj[n], t) && !ctx->removed[t];
+            }
+            if (degree < PHYSICAL_REGS) {
+                pick = n;
+                break;
+            }
+            if (pick == NO_TARGET || degree > pick_degree) {
+                pick = n;
+                pick_degree = degree;
+            }
+        }
+        if (pick == NO_TARGET) {
+            break;
+        }
+        ctx->removed[pick] = true;
+        ctx->stack[depth++] = pick;
+    }
+
+    unsigned error_count = 0;
+    while (depth > 0) {
+        uint16_t n = ctx->stack[--depth];
+        uint16_t taken = 0;
+        for (uint16_t t = 0; t < node_end; t++) {
+            if (regSetHas(&ctx->adj[n], t) && colorOf(ctx, t) != NO_COLOR) {
+                taken |= (uint16_t)(1u << colorOf(ctx, t));
+            }
+        }
+        uint8_t preferred = ctx->hint[n] != NO_TARGET ? colorOf(ctx, ctx->hint[n]) : NO_COLOR;
+        if (preferred != NO_COLOR && !(taken & (1u << preferred))) {
+            ctx->color[n] = preferred;
+            continue;
+        }
+        for (uint8_t c = 0; c < PHYSICAL_REGS && ctx->color[n] == NO_COLOR; c++) {
+            if (!(taken & (1u << c))) {
+                ctx->color[n] = c;
+            }
+        }
+        if (ctx->color[n] == NO_COLOR) {
+            Status res = makeStatus(ERR_ALLOC_PRESSURE, NO_POS, NO_POS, "No register left for '%s', it is live together with %u other values",
+                                    ctx->report->mappings[n - PHYSICAL_REGS].name, regSetCount(&ctx->adj[n]));
+            diagReport(ctx->sink, &res, "REGISTER ALLOCATION");
+            error_count++;
+        }
+    }
+    return error_count;
+}
+
+/* Rewrite the virtual operands with their registers and drop the copies which became LOAD %r, %r */
+Status rewriteProgram(AllocContext *ctx) {
+    for (uint16_t v = 0; v < ctx->report->virtual_count; v++) {
+        ctx->report->mappings[v].reg = colorOf(ctx, PHYSICAL_REGS + v);
+    }
+    uint16_t out = 0;
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        Instruction *instr = &ctx->instr_list[i];
+        bool move = isMove(ctx, instr);
+        TokenNode *args[2] = {instr->arg1, instr->arg2};
+        for (size_t a = 0; a < 2; a++) {
+            if (isVirtualRegister(args[a])) {
+                args[a]->tok.value = ctx->report->mappings[nodeOf(ctx, args[a]) - PHYSICAL_REGS].reg;
+            }
+        }
+        ctx->remap[i] = out;
+        if (move && instr->arg1->tok.value == instr->arg2->tok.value) {
+            ctx->report->copies_removed++;
+            continue;
+        }
+        ctx->instr_list[out++] = *instr;
+    }
+    ctx->remap[ctx->count] = out;
+    memset(&ctx->instr_list[out], 0, (ctx->count - out) * sizeof(Instruction));
+
+    for (size_t i = 0; i < ctx->sym_map->capacity; i++) {
+        Slot *slot = &ctx->sym_map->slots[i];
+        if (slot->key) {
+            uint16_t *loc = (uint16_t *)slot->value;
+            *loc = *loc <= ctx->count ? ctx->remap[*loc] : *loc;
+        }
+    }
+    ctx->count = out;
+    return (Status){.code = OK};
+}
+
+/* Cheap check done before the context (several hundred KB) is allocated, most programs name physical registers only */
+bool hasVirtualRegisters(const Instruction *instr_list, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        if (isVirtualRegister(instr_list[i].arg1) || isVirtualRegister(instr_list[i].arg2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Map the virtual registers '%v.<name>' onto the physical registers, the program must not be linked yet.
+    Liveness is computed over the control flow graph, copies between registers which never conflict are coalesced
+    and disappear. Registers set in reserved are never handed out. When the program uses RETE / RETD, an interrupt
+    handler may run between any two instructions: physical registers named anywhere are not handed out, and virtual
+    registers of the handlers never share a register with the other virtual registers. Errors are reported to the sink
+*/
+Status allocateRegisters(RegAllocReport *report, HashMap *inst_map, HashMap *sym_map, Instruction *instr_list, uint16_t *instr_count, uint16_t reserved, DiagSink *sink) {
+    memset(report, 0, sizeof(*report));
+    if (!hasVirtualRegisters(instr_list, *instr_count)) {
+        return (Status){.code = OK};
+    }
+    AllocContext *ctx = (AllocContext *)calloc(1, sizeof(AllocContext));
+    if (!ctx) {
+        return makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Error allocating register allocation context");
+    }
+    ctx->sym_map = sym_map;
+    ctx->instr_list = instr_list;
+    ctx->count = *instr_count;
+    ctx->report = report;
+    ctx->sink = sink;
+
+    Status res = lookupAllocDefinitions(ctx, inst_map);
+    if (res.code == OK && !allocHashMap(&ctx->vreg_map, 2 * MAX_VIRTUAL_REGS)) {
+        res = makeStatus(ERR_ALLOC_INTERNAL, NO_POS, NO_POS, "Error allocating virtual register hash map");
+    }
+    if (res.code == OK) {
+        res = numberVirtualRegisters(ctx);
+    }
+    if (res.code != OK || report->virtual_count == 0) {
+        goto done;
+    }
+
+    bool has_interrupts = false;
+    uint16_t named = 0;
+    for (uint16_t i = 0; i < ctx->count; i++) {
+        const Instruction *instr = &instr_list[i];
+        has_interrupts |= instr->instruction == ctx->rete_def || instr->instruction == ctx->retd_def;
+        TokenNode *args[2] = {instr->arg1, instr->arg2};
+        for (size_t a = 0; a < 2; a++) {
+            if (args[a] && args[a]->tok.type == TOK_REGISTER && !isVirtualRegister(args[a])) {
+                named |= (uint16_t)(1u << args[a]->tok.value);
+            }
+        }
+    }
+    reserved |= has_interrupts ? named : 0;
+
+    for (uint16_t n = 0; n < ALLOC_NODES; n++) {
+        ctx->alias[n] = n;
+        ctx->hint[n] = NO_TARGET;
+        ctx->color[n] = NO_COLOR;
+    }
+    buildFlow(ctx);
+    res = buildRoutines(ctx);
+    if (res.code != OK) {
+        goto done;
+    }
+    if (has_interrupts) {
+        markHandlerCode(ctx);
+    }
+    computeLiveness(ctx);
+    unsigned error_count = checkPressure(ctx, reserved);
+    if (error_count == 0) {
+        buildInterference(ctx, reserved);
+        coalesceCopies(ctx);
+        error_count = colorGraph(ctx);
+    }
+    if (error_count) {
+        res = makeStatus(ERR_ALLOC_PRESSURE, NO_POS, NO_POS, "%u register allocation error(s)", error_count);
+        goto done;
+    }
+    res = rewriteProgram(ctx);
+    *instr_count = ctx->count;
+
+done:
+    if (ctx->vreg_map) {
+        deallocHashMap(ctx->vreg_map);
+    }
+    free(ctx->routines);
+    free(ctx->returns.items);
+    free(ctx->callees.items);
+    free(ctx);
+    return res;
+}
+
+/* Print the register chosen for every virtual register */
+void printRegAllocReport(const RegAllocReport *report) {
+    if (report->virtual_count == 0) {
+        return;
+    }
+    for (uint16_t v = 0; v < report->virtual_count; v++) {
+        fprintf(stdout, "[REGISTERS]: %s -> %%%u\n", report->mappings[v].name, report->mappings[v].reg);
+    }
+    fprintf(stdout, "[REGISTERS]: %u virtual register(s), copies removed: %u, most values live at once: %u\n",
+            report->virtual_count, report->copies_removed, report->max_live);
+}
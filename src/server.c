@@ -0,0 +1,867 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+#include "arena.h"
+#include "format.h"
+#include "instruction.h"
+#include "io.h"
+#include "linker.h"
+#include "parser.h"
+#include "regalloc.h"
+#include "status.h"
+#include "token_list.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define link posix_link /* unistd.h declares a link() of its own, the one used here comes from linker.h */
+#include <unistd.h>
+#undef link
+
+#define JSON_MAX_DEPTH 32
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+typedef struct {
+    const char *id; /* Raw JSON text of the id, echoed as is */
+    size_t id_len;
+    const char *source;
+    size_t source_len;
+    const char *path;
+    const char *formats[SERVE_MAX_FORMATS];
+    size_t format_count;
+} ServeRequest;
+
+/* Everything a worker needs for one request. The arena holds the tokens, the decoded request and the rendered outputs,
+    it is rewound for the next request instead of freeing them one by one
+*/
+typedef struct {
+    HashMap *inst_map; /* Shared, only read */
+    const FormatTemplate *builtins;
+    Arena arena;
+    HashMap *sym_map;
+    Instruction *instr_list;
+    uint16_t instr_used;
+    RegAllocReport regs;
+    OutBuf out;
+} ServeWorker;
+
+/* A client: stdin / stdout, or a connection of the socket. Its requests are queued one by one, so they can be answered
+    by different workers; every answer is written whole under the lock, in completion order. The poll loop holds a
+    reference until the client is read to the end and every queued request holds one, the last one frees it
+*/
+typedef struct {
+    int in_fd;
+    int out_fd;
+    char *buf;
+    size_t start;
+    size_t len;
+    size_t cap;
+    pthread_mutex_t lock;
+    unsigned refs;
+} ServeConn;
+
+typedef struct {
+    char *line;
+    size_t len;
+    ServeConn *conn;
+} ServeJob;
+
+/* Requests read by the poll loop wait here for a worker */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    ServeJob jobs[SERVE_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    bool closed;
+} JobQueue;
+
+typedef struct {
+    ServeWorker worker;
+    pthread_t thread;
+    JobQueue *queue;
+} ServeThread;
+
+/* Clients watched by the poll loop, the listening socket has no client */
+typedef struct {
+    struct pollfd *fds;
+    ServeConn **conns;
+    size_t count;
+    size_t cap;
+} ServePoll;
+
+static const char *builtin_names[] = {"debug", "vhdlbin", "vhdlhex"};
+static const char *builtin_sources[] = {FORMAT_DEBUG, FORMAT_VHDL_BIN, FORMAT_VHDL_HEX};
+static const char *serve_socket_path = NULL;
+
+static bool outReserve(OutBuf *ob, size_t extra) {
+    if (ob->len + extra <= ob->cap) {
+        return true;
+    }
+    size_t cap = ob->cap ? ob->cap : 4096;
+    while (cap < ob->len + extra) {
+        cap *= 2;
+    }
+    char *data = (char *)realloc(ob->data, cap);
+    if (!data) {
+        return false;
+    }
+    ob->data = data;
+    ob->cap = cap;
+    return true;
+}
+
+static void outPut(OutBuf *ob, const char *s, size_t n) {
+    if (outReserve(ob, n)) {
+        memcpy(ob->data + ob->len, s, n);
+        ob->len += n;
+    }
+}
+
+static void outStr(OutBuf *ob, const char *s) {
+    outPut(ob, s, strlen(s));
+}
+
+static void outUnsigned(OutBuf *ob, unsigned v) {
+    char num[16];
+    outPut(ob, num, (size_t)snprintf(num, sizeof(num), "%u", v));
+}
+
+/* Quote and escape a string, runs without special characters are copied at once */
+static void outJsonString(OutBuf *ob, const char *s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    if (!outReserve(ob, n + 2)) {
+        return;
+    }
+    ob->data[ob->len++] = '"';
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        outPut(ob, s + run, i - run);
+        run = i + 1;
+        char esc[6] = {'\\', 0};
+        size_t esc_len = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            esc[1] = (char)c;
+            break;
+        case '\n':
+            esc[1] = 'n';
+            break;
+        case '\t':
+            esc[1] = 't';
+            break;
+        case '\r':
+            esc[1] = 'r';
+            break;
+        default:
+            memcpy(esc + 1, "u00", 3);
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xF];
+            esc_len = 6;
+            break;
+        }
+        outPut(ob, esc, esc_len);
+    }
+    outPut(ob, s + run, n - run);
+    outPut(ob, "\"", 1);
+}
+
+static const char *skipWs(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+static unsigned hexValue(const char *p) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        unsigned d = (c >= '0' && c <= '9') ? (unsigned)(c - '0') : (c >= 'a' && c <= 'f') ? (unsigned)(c - 'a' + 10) : (c >= 'A' && c <= 'F') ? (unsigned)(c - 'A' + 10) : 16;
+        if (d == 16) {
+            return 0x110000; /* Not a code point */
+        }
+        v = v << 4 | d;
+    }
+    return v;
+}
+
+/* Read a JSON string starting at its opening quote. Decoded into the arena when out is set, only skipped otherwise */
+static const char *readJsonString(const char *p, const char *end, Arena *arena, const char **out, size_t *out_len) {
+    if (p >= end || *p != '"') {
+        return NULL;
+    }
+    const char *start = ++p;
+    while (p < end && *p != '"') {
+        p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+    }
+    if (p >= end) {
+        return NULL;
+    }
+    if (!out) {
+        return p + 1;
+    }
+    /* Escapes only shrink the text */
+    char *dst = (char *)arenaAlloc(arena, (size_t)(p - start) + 1);
+    if (!dst) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (const char *s = start; s < p; s++) {
+        if (*s != '\\') {
+            dst[n++] = *s;
+            continue;
+        }
+        s++;
+        switch (*s) {
+        case 'n':
+            dst[n++] = '\n';
+            break;
+        case 't':
+            dst[n++] = '\t';
+            break;
+        case 'r':
+            dst[n++] = '\r';
+            break;
+        case 'b':
+            dst[n++] = '\b';
+            break;
+        case 'f':
+            dst[n++] = '\f';
+            break;
+        case 'u': {
+            if (p - s < 5) {
+                return NULL;
+            }
+            unsigned cp = hexValue(s + 1);
+            s += 4;
+            if (cp >= 0xD800 && cp < 0xDC00 && p - s >= 7 && s[1] == '\\' && s[2] == 'u') {
+                unsigned low = hexValue(s + 3);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    s += 6;
+                }
+            }
+            if (cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) {
+                return NULL;
+            }
+            /* UTF-8, never longer than the 6 characters of the escape */
+            if (cp < 0x80) {
+                dst[n++] = (char)cp;
+            } else if (cp < 0x800) {
+                dst[n++] = (char)(0xC0 | cp >> 6);
+                dst[n++] = (char)(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                dst[n++] = (char)(0xE0 | cp >> 12);
+                dst[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                dst[n++] = (char)(0x80 | (cp & 0x3F));
+            } else {
+                dst[n++] = (char)(0xF0 | cp >> 18);
+                dst[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                dst[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                dst[n++] = (char)(0x80 | (cp & 0x3F));
+            }
+            break;
+        }
+        default: /* '"', '\\' and '/' stand for themselves */
+            dst[n++] = *s;
+            break;
+        }
+    }
+    dst[n] = '\0';
+    *out = dst;
+    *out_len = n;
+    return p + 1;
+}
+
+/* Skip any JSON value, returns the position after it or NULL when it is malformed */
+static const char *skipJsonValue(const char *p, const char *end, unsigned depth) {
+    p = skipWs(p, end);
+    if (p >= end || depth > JSON_MAX_DEPTH) {
+        return NULL;
+    }
+    if (*p == '"') {
+        return readJsonString(p, end, NULL, NULL, NULL);
+    }
+    if (*p == '{' || *p == '[') {
+        char close = (*p == '{') ? '}' : ']';
+        bool is_object = *p == '{';
+        p = skipWs(p + 1, end);
+        if (p < end && *p == close) {
+            return p + 1;
+        }
+        while (p) {
+            if (is_object) {
+                p = readJsonString(skipWs(p, end), end, NULL, NULL, NULL);
+                p = p ? skipWs(p, end) : NULL;
+                if (!p || p >= end || *p != ':') {
+                    return NULL;
+                }
+                p++;
+            }
+            p = skipJsonValue(p, end, depth + 1);
+            p = p ? skipWs(p, end) : NULL;
+            if (!p || p >= end) {
+                return NULL;
+            }
+            if (*p == close) {
+                return p + 1;
+            }
+            p = (*p == ',') ? p + 1 : NULL;
+        }
+        return NULL;
+    }
+    const char *start = p;
+    while (p < end && strchr("-+.0123456789eEtruefalsn", *p)) {
+        p++;
+    }
+    return p > start ? p : NULL;
+}
+
+static Status requestError(const char *msg) {
+    return makeStatus(ERR_SERVE_REQUEST, NO_POS, NO_POS, "Bad request: %s", msg);
+}
+
+/* Read the fields of a request object, unknown fields are ignored */
+static Status parseRequest(ServeRequest *req, const char *line, size_t len, Arena *arena) {
+    *req = (ServeRequest){0};
+    const char *end = line + len;
+    const char *p = skipWs(line, end);
+    if (p >= end || *p != '{') {
+        return requestError("expected a JSON object");
+    }
+    p = skipWs(p + 1, end);
+    if (p < end && *p == '}') {
+        return requestError("expected source or path");
+    }
+    while (p) {
+        const char *key = NULL;
+        size_t key_len = 0;
+        p = readJsonString(skipWs(p, end), end, arena, &key, &key_len);
+        p = p ? skipWs(p, end) : NULL;
+        if (!p || p >= end || *p != ':') {
+            return requestError("malformed object");
+        }
+        p = skipWs(p + 1, end);
+        if (!strcmp(key, "id")) {
+            const char *value_end = skipJsonValue(p, end, 0);
+            if (!value_end || *p == '{' || *p == '[') {
+                return requestError("id must be a number or a string");
+            }
+            req->id = p;
+            req->id_len = (size_t)(value_end - p);
+            p = value_end;
+        } else if (!strcmp(key, "source")) {
+            p = readJsonString(p, end, arena, &req->source, &req->source_len);
+        } else if (!strcmp(key, "path")) {
+            size_t path_len = 0;
+            p = readJsonString(p, end, arena, &req->path, &path_len);
+        } else if (!strcmp(key, "formats")) {
+            if (p >= end || *p != '[') {
+                return requestError("formats must be an array of strings");
+            }
+            p = skipWs(p + 1, end);
+            while (p && p < end && *p != ']') {
+                if (req->format_count == SERVE_MAX_FORMATS) {
+                    return requestError("too many formats");
+                }
+                size_t format_len = 0;
+                p = readJsonString(p, end, arena, &req->formats[req->format_count++], &format_len);
+                p = p ? skipWs(p, end) : NULL;
+                if (p && p < end && *p == ',') {
+                    p = skipWs(p + 1, end);
+                }
+            }
+            p = (p && p < end) ? p + 1 : NULL;
+        } else {
+            p = skipJsonValue(p, end, 0);
+        }
+        p = p ? skipWs(p, end) : NULL;
+        if (!p || p >= end) {
+            return requestError("malformed object");
+        }
+        if (*p == '}') {
+            break;
+        }
+        p = (*p == ',') ? p + 1 : NULL;
+    }
+    if (!p) {
+        return requestError("malformed object");
+    }
+    if (!req->source == !req->path) {
+        return requestError("expected either source or path");
+    }
+    return (Status){.code = OK};
+}
+
+/* Find a built-in format by name or compile the template given instead */
+static Status resolveFormat(ServeWorker *w, const char *spec, FormatTemplate *scratch, const FormatTemplate **out) {
+    for (size_t i = 0; i < sizeof(builtin_names) / sizeof(builtin_names[0]); i++) {
+        if (!strcmp(spec, builtin_names[i])) {
+            *out = &w->builtins[i];
+            return (Status){.code = OK};
+        }
+    }
+    *out = scratch;
+    return compileTemplate(scratch, spec);
+}
+
+/* Keep the status of a failed phase, the summary is only added when no detailed error was collected */
+static bool phaseOk(DiagSink *diag, size_t diag_before, const Status *s, const char *tag) {
+    if (s->code != OK && diag->count == diag_before) {
+        diagReport(diag, s, tag);
+    }
+    return s->code == OK;
+}
+
+static void writeDiagnostics(OutBuf *ob, const DiagSink *diag) {
+    outStr(ob, "[");
+    for (size_t i = 0; i < diag->count; i++) {
+        const Status *s = &diag->items[i];
+        char message[256];
+        size_t len = formatStatus(s, message, sizeof(message));
+        outStr(ob, i ? ",{\"tag\":" : "{\"tag\":");
+        outJsonString(ob, diag->tags[i], strlen(diag->tags[i]));
+        outStr(ob, ",\"code\":");
+        outUnsigned(ob, (unsigned)s->code);
+        outStr(ob, ",\"line\":");
+        if (s->line == NO_POS) {
+            outStr(ob, "null");
+        } else {
+            outUnsigned(ob, s->line);
+        }
+        outStr(ob, ",\"col\":");
+        if (s->col == NO_POS) {
+            outStr(ob, "null");
+        } else {
+            outUnsigned(ob, s->col);
+        }
+        outStr(ob, ",\"message\":");
+        outJsonString(ob, message, len);
+        outStr(ob, "}");
+    }
+    outStr(ob, "]");
+}
+
+/* Assemble one request and leave its answer line in w->out */
+static void handleRequest(ServeWorker *w, const char *line, size_t len) {
+    arenaReset(&w->arena);
+    w->out.len = 0;
+    DiagSink diag;
+    diagInit(&diag);
+    TokenList tl;
+    tokenListInitArena(&tl, &w->arena);
+    ServeRequest req;
+    FormatTemplate scratch[SERVE_MAX_FORMATS];
+    const FormatTemplate *formats[SERVE_MAX_FORMATS];
+    uint16_t loc = 0;
+
+    Status req_ok = parseRequest(&req, line, len, &w->arena);
+    bool ok = phaseOk(&diag, 0, &req_ok, "REQUEST");
+    if (ok && req.format_count == 0) {
+        req.formats[req.format_count++] = builtin_names[0];
+    }
+    for (size_t i = 0; ok && i < req.format_count; i++) {
+        Status format_ok = resolveFormat(w, req.formats[i], &scratch[i], &formats[i]);
+        ok = phaseOk(&diag, 0, &format_ok, "OUTPUT TEMPLATE");
+    }
+    if (ok) {
+        Status read_ok = req.source ? readTokensFromBuffer(&tl, req.source, req.source_len, "request", &diag, 1)
+                                    : readTokensFromFile(&tl, req.path, &diag, 1);
+        ok = phaseOk(&diag, 0, &read_ok, "I/O + TOKEN");
+    }
+    if (ok) {
+        Status parse_ok = parseTokenList(&tl, w->inst_map, w->sym_map, w->instr_list, &loc, &diag);
+        w->instr_used = loc;
+        ok = phaseOk(&diag, 0, &parse_ok, "PARSE");
+    }
+    if (ok) {
+        Status alloc_ok = allocateRegisters(&w->regs, w->inst_map, w->sym_map, w->instr_list, &loc, 0, &diag);
+        ok = phaseOk(&diag, 0, &alloc_ok, "REGISTER ALLOCATION");
+    }
+    if (ok) {
+        Status link_ok = link(w->instr_list, loc, w->sym_map, &diag);
+        ok = phaseOk(&diag, 0, &link_ok, "LINKING");
+    }
+
+    outStr(&w->out, "{\"id\":");
+    if (req.id) {
+        outPut(&w->out, req.id, req.id_len);
+    } else {
+        outStr(&w->out, "null");
+    }
+    outStr(&w->out, ok ? ",\"ok\":true,\"words\":" : ",\"ok\":false,\"words\":");
+    outUnsigned(&w->out, ok ? loc : 0);
+    outStr(&w->out, ",\"outputs\":{");
+    for (size_t i = 0; ok && i < req.format_count; i++) {
+        char *image = (char *)arenaAlloc(&w->arena, loc * formats[i]->max_line + 1);
+        if (!image) {
+            break;
+        }
+        if (i) {
+            outStr(&w->out, ",");
+        }
+        outJsonString(&w->out, req.formats[i], strlen(req.formats[i]));
+        outStr(&w->out, ":");
+        outJsonString(&w->out, image, renderInstructions(w->instr_list, loc, formats[i], image));
+    }
+    outStr(&w->out, "},\"diagnostics\":");
+    writeDiagnostics(&w->out, &diag);
+    outStr(&w->out, "}\n");
+
+    /* Leave the worker as it was for the next request */
+    diagFree(&diag);
+    deallocTokenList(&tl);
+    clearHashMap(w->sym_map);
+    memset(w->instr_list, 0, ((size_t)w->instr_used + 1) * sizeof(Instruction));
+    w->instr_used = 0;
+}
+
+static bool initWorker(ServeWorker *w, HashMap *inst_map, const FormatTemplate *builtins) {
+    *w = (ServeWorker){.inst_map = inst_map, .builtins = builtins};
+    arenaInit(&w->arena);
+    w->instr_list = (Instruction *)calloc(MAX_PROGRAM_SIZE + 1, sizeof(Instruction));
+    return w->instr_list && allocHashMap(&w->sym_map, HASH_MAP_BUCKETS);
+}
+
+static void freeWorker(ServeWorker *w) {
+    arenaFree(&w->arena);
+    free(w->instr_list);
+    free(w->out.data);
+    if (w->sym_map) {
+        deallocHashMap(w->sym_map);
+    }
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static const char serve_too_long[] =
+    "{\"id\":null,\"ok\":false,\"words\":0,\"outputs\":{},\"diagnostics\":[{\"tag\":\"REQUEST\",\"code\":0,"
+    "\"line\":null,\"col\":null,\"message\":\"Request too long, closing the connection\"}]}\n";
+
+static ServeConn *newConnection(int in_fd, int out_fd) {
+    ServeConn *c = (ServeConn *)calloc(1, sizeof(ServeConn));
+    if (!c) {
+        return NULL;
+    }
+    c->in_fd = in_fd;
+    c->out_fd = out_fd;
+    c->refs = 1;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+static void releaseConnection(ServeConn *c) {
+    pthread_mutex_lock(&c->lock);
+    bool last = --c->refs == 0;
+    pthread_mutex_unlock(&c->lock);
+    if (last) {
+        if (c->in_fd != STDIN_FILENO) {
+            close(c->in_fd);
+        }
+        pthread_mutex_destroy(&c->lock);
+        free(c->buf);
+        free(c);
+    }
+}
+
+static void answerConnection(ServeConn *c, const char *data, size_t len) {
+    pthread_mutex_lock(&c->lock);
+    writeAll(c->out_fd, data, len);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Copy a request line into a job for the workers, waits while the queue is full */
+static bool queueRequest(JobQueue *q, ServeConn *c, const char *line, size_t len) {
+    ServeJob job = {.line = (char *)malloc(len + 1), .len = len, .conn = c};
+    if (!job.line) {
+        return false;
+    }
+    memcpy(job.line, line, len);
+    pthread_mutex_lock(&c->lock);
+    c->refs++;
+    pthread_mutex_unlock(&c->lock);
+    pthread_mutex_lock(&q->lock);
+    while (q->count == SERVE_QUEUE_SIZE) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->jobs[(q->head + q->count) % SERVE_QUEUE_SIZE] = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+/* Read what a readable client sent and queue its complete lines. Returns false once the client is done:
+    at the end of its stream (a last line without newline still counts), on errors and on overlong lines
+*/
+static bool readConnection(JobQueue *q, ServeConn *c) {
+    if (c->start > 0) { /* Keep the partial line at the front */
+        memmove(c->buf, c->buf + c->start, c->len - c->start);
+        c->len -= c->start;
+        c->start = 0;
+    }
+    if (c->len == c->cap) {
+        size_t cap = c->cap ? 2 * c->cap : 64 * 1024;
+        char *buf = cap <= SERVE_MAX_REQUEST_SIZE ? (char *)realloc(c->buf, cap) : NULL;
+        if (!buf) {
+            answerConnection(c, serve_too_long, sizeof(serve_too_long) - 1);
+            return false;
+        }
+        c->buf = buf;
+        c->cap = cap;
+    }
+    ssize_t n = read(c->in_fd, c->buf + c->len, c->cap - c->len);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    if (n <= 0) {
+        if (n == 0 && c->len > 0) {
+            queueRequest(q, c, c->buf, c->len);
+        }
+        return false;
+    }
+    c->len += (size_t)n;
+    char *nl;
+    while ((nl = (char *)memchr(c->buf + c->start, '\n', c->len - c->start))) {
+        if (!queueRequest(q, c, c->buf + c->start, (size_t)(nl - (c->buf + c->start)))) {
+            return false;
+        }
+        c->start = (size_t)(nl - c->buf) + 1;
+    }
+    return true;
+}
+
+static bool watchClient(ServePoll *sp, int fd, ServeConn *c) {
+    if (sp->count == sp->cap) {
+        size_t cap = sp->cap ? 2 * sp->cap : 16;
+        struct pollfd *fds = (struct pollfd *)realloc(sp->fds, cap * sizeof(struct pollfd));
+        if (fds) {
+            sp->fds = fds;
+        }
+        ServeConn **conns = fds ? (ServeConn **)realloc(sp->conns, cap * sizeof(ServeConn *)) : NULL;
+        if (!conns) {
+            return false;
+        }
+        sp->conns = conns;
+        sp->cap = cap;
+    }
+    sp->fds[sp->count] = (struct pollfd){.fd = fd, .events = POLLIN};
+    sp->conns[sp->count++] = c;
+    return true;
+}
+
+/* Read every client as its data arrives and hand each request to the workers, so a client holding its connection open
+    does not keep a worker. Runs until stdin is closed, or until the process is stopped when listening on a socket
+*/
+static bool pollClients(JobQueue *q, int listen_fd) {
+    ServePoll sp = {0};
+    bool ok = true;
+    if (listen_fd >= 0) {
+        ok = watchClient(&sp, listen_fd, NULL);
+    } else {
+        ServeConn *c = newConnection(STDIN_FILENO, STDOUT_FILENO);
+        ok = c && watchClient(&sp, STDIN_FILENO, c);
+    }
+    while (ok && sp.count > 0) {
+        if (poll(sp.fds, sp.count, -1) < 0) {
+            ok = errno == EINTR;
+            continue;
+        }
+        for (size_t i = sp.count; i-- > 0;) {
+            if (!sp.fds[i].revents) {
+                continue;
+            }
+            ServeConn *c = sp.conns[i];
+            if (!c) {
+                int fd = accept(listen_fd, NULL, NULL);
+                if (fd < 0) {
+                    ok = errno == EINTR || errno == ECONNABORTED || errno == EAGAIN;
+                    continue;
+                }
+                ServeConn *client = newConnection(fd, fd);
+                if (!client || !watchClient(&sp, fd, client)) {
+                    close(fd);
+                    free(client);
+                }
+                continue;
+            }
+            if (!readConnection(q, c)) {
+                sp.fds[i] = sp.fds[sp.count - 1];
+                sp.conns[i] = sp.conns[sp.count - 1];
+                sp.count--;
+                releaseConnection(c);
+            }
+        }
+    }
+    for (size_t i = 0; i < sp.count; i++) {
+        if (sp.conns[i]) {
+            releaseConnection(sp.conns[i]);
+        }
+    }
+    free(sp.fds);
+    free(sp.conns);
+    return ok;
+}
+
+static void *queueWorker(void *arg) {
+    ServeThread *t = (ServeThread *)arg;
+    JobQueue *q = t->queue;
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        while (q->count == 0 && !q->closed) {
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        }
+        if (q->count == 0) {
+            pthread_mutex_unlock(&q->lock);
+            return NULL;
+        }
+        ServeJob job = q->jobs[q->head];
+        q->head = (q->head + 1) % SERVE_QUEUE_SIZE;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        pthread_mutex_unlock(&q->lock);
+
+        handleRequest(&t->worker, job.line, job.len);
+        free(job.line);
+        answerConnection(job.conn, t->worker.out.data, t->worker.out.len);
+        releaseConnection(job.conn);
+    }
+}
+
+static void stopServer(int sig) {
+    (void)sig;
+    if (serve_socket_path) {
+        unlink(serve_socket_path);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static int openSocket(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[pico-assembler] Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("[pico-assembler] socket");
+        return -1;
+    }
+    unlink(path); /* Left behind by a previous server */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror("[pico-assembler] bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve until stdin is closed, or until the process is stopped when listening on a socket.
+    Returns EXIT_FAILURE when the socket or the workers can not be set up, or reading the requests fails
+*/
+int runServer(const char *socket_path, unsigned worker_count, HashMap *inst_map) {
+    FormatTemplate builtins[sizeof(builtin_sources) / sizeof(builtin_sources[0])];
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        compileTemplate(&builtins[i], builtin_sources[i]);
+    }
+    signal(SIGPIPE, SIG_IGN); /* A client leaving early only fails its write */
+
+    int listen_fd = -1;
+    if (socket_path) {
+        listen_fd = openSocket(socket_path);
+        if (listen_fd < 0) {
+            return EXIT_FAILURE;
+        }
+        serve_socket_path = socket_path;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+    }
+
+    JobQueue queue = {.closed = false};
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+
+    ServeThread *threads = (ServeThread *)calloc(worker_count, sizeof(ServeThread));
+    unsigned started = 0;
+    for (unsigned i = 0; threads && i < worker_count; i++) {
+        ServeThread *t = &threads[i];
+        t->queue = &queue;
+        if (!initWorker(&t->worker, inst_map, builtins) || pthread_create(&t->thread, NULL, queueWorker, t) != 0) {
+            freeWorker(&t->worker);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "[pico-assembler] Could not start the server workers\n");
+        free(threads);
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(socket_path);
+        }
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "[pico-assembler] Serving on %s with %u workers\n", socket_path ? socket_path : "stdin", started);
+
+    bool ok = pollClients(&queue, listen_fd);
+    if (!ok) {
+        fprintf(stderr, "[pico-assembler] Reading requests failed: %s\n", strerror(errno));
+    }
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = true;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+        freeWorker(&threads[i].worker);
+    }
+    free(threads);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else
+int runServer(const char *socket_path, unsigned worker_count, HashMap *inst_map) {
+    (void)socket_path;
+    (void)worker_count;
+    (void)inst_map;
+    fprintf(stderr, "[pico-assembler] --serve is not available on this platform\n");
+    return EXIT_FAILURE;
+}
+#endif
@@ -1,26 +1,395 @@
 #include "status.h"
+#include <assert.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-/* Used to return status from functions where execution might fail*/
-Status makeStatus(StatusCode code, uint8_t line, uint8_t col, const char *fmt, ...) {
-    Status s = {.code = code, .line = line, .col = col};
+/* Find the next conversion of a printf-like format, *conv points to its conversion character
+    Flags, width, precision (given as '*' too) and length modifiers are skipped
+*/
+const char *nextConversion(const char *p, const char **conv) {
+    while (*p) {
+        if (p[0] == '%' && p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        if (p[0] == '%') {
+            const char *q = p + 1;
+            while (*q && strchr("-+ #0123456789.*hljztL", *q)) {
+                q++;
+            }
+            *conv = q;
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Length modifier of a conversion: 'H' for hh, 'q' for ll, otherwise the modifier or 0 */
+char conversionLength(const char *start, const char *conv) {
+    if (conv - start >= 3 && conv[-1] == conv[-2] && (conv[-1] == 'h' || conv[-1] == 'l')) {
+        return conv[-1] == 'h' ? 'H' : 'q';
+    }
+    if (conv - start >= 2 && strchr("hljztL", conv[-1])) {
+        return conv[-1];
+    }
+    return 0;
+}
+
+/* How the argument of a conversion is recorded: 's' string, 'i' signed, 'u' unsigned, 'c' character, 'p' pointer,
+    'f' floating point, 0 when it is not supported
+*/
+char statusArgKind(char conv, char length) {
+    if (conv == '\0') {
+        return 0;
+    }
+    if (strchr("di", conv)) {
+        return 'i';
+    }
+    if (strchr("ouxX", conv)) {
+        return 'u';
+    }
+    if (strchr("fFeEgGaA", conv)) {
+        return 'f';
+    }
+    if (length) { /* Wide characters and strings */
+        return 0;
+    }
+    return strchr("scp", conv) ? conv : 0;
+}
+
+/* Copy a string into the status, using text up to limit. Returns its reference (0 for NULL) */
+unsigned copyStatusText(Status *s, const char *str, size_t limit) {
+    if (!str) {
+        return 0;
+    }
+    if (s->text_len >= limit) { /* Refer to the terminator of the last string */
+        return s->text_len;
+    }
+    size_t room = limit - s->text_len;
+    unsigned ref = s->text_len + 1u;
+    char *dst = s->text + s->text_len;
+    size_t len = strlen(str);
+    if (len < room) {
+        memcpy(dst, str, len + 1);
+        s->text_len += (uint8_t)(len + 1);
+        return ref;
+    }
+    memcpy(dst, str, room - 1);
+    if (room > 3) {
+        memcpy(dst + room - 4, "...", 3);
+    }
+    dst[room - 1] = '\0';
+    s->text_len = (uint8_t)limit;
+    return ref;
+}
+
+const char *statusText(const Status *s, unsigned ref) {
+    return ref ? s->text + ref - 1 : NULL;
+}
+
+/* Record the instruction an error was found in, printed before the message */
+void setStatusAt(Status *s, const char *at) {
+    s->at = (uint8_t)copyStatusText(s, at, STATUS_TEXT_SIZE);
+}
+
+/* Used to return status from functions where execution might fail
+    Only the arguments are recorded here, formatting is deferred until the status is printed
+*/
+Status makeStatus(StatusCode code, uint32_t line, uint32_t col, const char *fmt, ...) {
+    Status s = {.code = code, .line = line, .col = col, .fmt = fmt};
     va_list args;
     va_start(args, fmt);
-    vsnprintf(s.message, sizeof(s.message), fmt, args);
+    const char *conv = NULL;
+    size_t idx = 0;
+    for (const char *p = nextConversion(fmt, &conv); p && *conv && idx < STATUS_MAX_ARGS; p = nextConversion(conv + 1, &conv)) {
+        for (const char *q = p + 1; q < conv && idx < STATUS_MAX_ARGS; q++) {
+            if (*q == '*') {
+                s.args[idx++].num = va_arg(args, int);
+            }
+        }
+        char length = conversionLength(p, conv);
+        char kind = statusArgKind(*conv, length);
+        if (idx == STATUS_MAX_ARGS) {
+            break;
+        }
+        switch (kind) {
+        case 's':
+            s.args[idx++].str = copyStatusText(&s, va_arg(args, const char *), STATUS_TEXT_SIZE - STATUS_AT_ROOM);
+            break;
+        case 'c':
+            s.args[idx++].num = va_arg(args, int);
+            break;
+        case 'p':
+            s.args[idx++].ptr = va_arg(args, const void *);
+            break;
+        case 'f':
+            s.args[idx++].real = length == 'L' ? (double)va_arg(args, long double) : va_arg(args, double);
+            break;
+        case 'i': {
+            long long v;
+            switch (length) {
+            case 'q': v = va_arg(args, long long); break;
+            case 'l': v = va_arg(args, long); break;
+            case 'j': v = va_arg(args, intmax_t); break;
+            case 'z':
+            case 't': v = va_arg(args, ptrdiff_t); break;
+            case 'h': v = (short)va_arg(args, int); break;
+            case 'H': v = (signed char)va_arg(args, int); break;
+            default: v = va_arg(args, int); break;
+            }
+            s.args[idx++].num = v;
+            break;
+        }
+        case 'u': {
+            unsigned long long v;
+            switch (length) {
+            case 'q': v = va_arg(args, unsigned long long); break;
+            case 'l': v = va_arg(args, unsigned long); break;
+            case 'j': v = va_arg(args, uintmax_t); break;
+            case 'z': v = va_arg(args, size_t); break;
+            case 't': v = (unsigned long long)va_arg(args, ptrdiff_t); break;
+            case 'h': v = (unsigned short)va_arg(args, unsigned); break;
+            case 'H': v = (unsigned char)va_arg(args, unsigned); break;
+            default: v = va_arg(args, unsigned); break;
+            }
+            s.args[idx++].unum = v;
+            break;
+        }
+        default: /* %n or a wide conversion, the remaining arguments can not be read safely */
+            assert(!"makeStatus: %n and wide characters / strings are not recorded");
+            idx = STATUS_MAX_ARGS;
+            break;
+        }
+    }
     va_end(args);
     return s;
 }
 
+/* Rebuild the spec of a conversion for the recorded argument: '*' replaced by the recorded values and integer
+    lengths by ll. Returns the index of the argument of the conversion itself
+*/
+size_t statusSpec(const Status *s, const char *start, const char *conv, size_t idx, char *spec, size_t spec_size) {
+    size_t len = 0;
+    char kind = statusArgKind(*conv, conversionLength(start, conv));
+    for (const char *q = start; q < conv && len + 24 < spec_size; q++) {
+        if (*q == '*') {
+            len += (size_t)snprintf(spec + len, spec_size - len, "%lld", idx < STATUS_MAX_ARGS ? s->args[idx].num : 0);
+            idx++;
+        } else if (!strchr("hljztL", *q)) {
+            spec[len++] = *q;
+        }
+    }
+    if (kind == 'i' || kind == 'u') {
+        spec[len++] = 'l';
+        spec[len++] = 'l';
+    }
+    spec[len++] = *conv;
+    spec[len] = '\0';
+    return idx;
+}
+
+void appendText(char *buf, size_t buf_size, size_t *len, const char *fmt, ...) {
+    if (*len + 1 >= buf_size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(buf + *len, buf_size - *len, fmt, args);
+    va_end(args);
+    if (written > 0) {
+        *len += (size_t)written;
+        if (*len >= buf_size) {
+            *len = buf_size - 1;
+        }
+    }
+}
+
+void appendSpan(char *buf, size_t buf_size, size_t *len, const char *p, size_t n) {
+    if (*len + n >= buf_size) {
+        n = buf_size - 1 - *len;
+    }
+    memcpy(buf + *len, p, n);
+    *len += n;
+    buf[*len] = '\0';
+}
+
+/* Build the message text of a status, returns its length */
+size_t formatStatus(const Status *s, char *buf, size_t buf_size) {
+    size_t len = 0;
+    if (buf_size == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+    if (s->at) {
+        appendText(buf, buf_size, &len, "At '%s': ", statusText(s, s->at));
+    }
+    const char *p = s->fmt ? s->fmt : "";
+    size_t idx = 0;
+    while (*p) {
+        const char *conv = NULL;
+        const char *start = nextConversion(p, &conv);
+        /* Literal text up to the conversion, with '%%' unescaped */
+        const char *end = start ? start : p + strlen(p);
+        while (p < end) {
+            const char *pct = memchr(p, '%', (size_t)(end - p));
+            const char *stop = pct ? pct + 1 : end;
+            appendSpan(buf, buf_size, &len, p, (size_t)(stop - p));
+            p = pct ? pct + 2 : end;
+        }
+        if (!start) {
+            break;
+        }
+        if (!*conv) {
+            p = conv;
+            break;
+        }
+        char spec[64];
+        idx = statusSpec(s, start, conv, idx, spec, sizeof(spec));
+        char kind = statusArgKind(*conv, conversionLength(start, conv));
+        if (idx >= STATUS_MAX_ARGS || !kind) {
+            appendText(buf, buf_size, &len, "?");
+        } else if (kind == 's') {
+            const char *str = statusText(s, s->args[idx].str);
+            appendText(buf, buf_size, &len, spec, str ? str : "(null)");
+        } else if (kind == 'c') {
+            appendText(buf, buf_size, &len, spec, (int)s->args[idx].num);
+        } else if (kind == 'i') {
+            appendText(buf, buf_size, &len, spec, s->args[idx].num);
+        } else if (kind == 'u') {
+            appendText(buf, buf_size, &len, spec, s->args[idx].unum);
+        } else if (kind == 'p') {
+            appendText(buf, buf_size, &len, spec, s->args[idx].ptr);
+        } else {
+            appendText(buf, buf_size, &len, spec, s->args[idx].real);
+        }
+        idx++;
+        p = conv + 1;
+    }
+    return len;
+}
+
+/* Build the full report line of a status, as printed by printStatus */
+size_t formatStatusLine(const Status *s, const char *tag, char *buf, size_t buf_size) {
+    char message[256];
+    size_t len = 0;
+    formatStatus(s, message, sizeof(message));
+    if (s->line == NO_POS && s->col == NO_POS) { /* Means that they are not relevant */
+        appendText(buf, buf_size, &len, "[ERROR -> %s]: %s\n", tag, message);
+    } else if (s->col == NO_POS) {
+        appendText(buf, buf_size, &len, "[ERROR -> %s]: %s : (%u)\n", tag, message, s->line);
+    } else {
+        appendText(buf, buf_size, &len, "[ERROR -> %s]: %s : (%u:%u)\n", tag, message, s->line, s->col);
+    }
+    return len;
+}
+
 /* Format print a returned status message */
 void printStatus(const Status *s, const char *tag) {
     if (s->code == OK) {
         fprintf(stdout, "[OK]: %s\n", tag);
     } else {
-        if (s->line == NO_POS && s->col == NO_POS) { /* Means that they are not relevant */
-            fprintf(stderr, "[ERROR -> %s]: %s", tag, s->message);
-        } else {
-            fprintf(stderr, "[ERROR -> %s]: %s : (%u:%u)\n", tag, s->message, s->line, s->col);
+        char line[384];
+        formatStatusLine(s, tag, line, sizeof(line));
+        fputs(line, stderr);
+    }
+}
+
+void diagInit(DiagSink *sink) {
+    *sink = (DiagSink){0};
+}
+
+/* Keep a copy of an error, its string arguments are held by the status itself */
+void diagReport(DiagSink *sink, const Status *s, const char *tag) {
+    if (s->code == OK) {
+        return;
+    }
+    if (sink->count == sink->capacity) {
+        size_t capacity = sink->capacity ? 2 * sink->capacity : 16;
+        Status *items = (Status *)realloc(sink->items, capacity * sizeof(Status));
+        if (items) {
+            sink->items = items;
+        }
+        const char **tags = (const char **)realloc(sink->tags, capacity * sizeof(const char *));
+        if (tags) {
+            sink->tags = tags;
+        }
+        if (!items || !tags) { /* Out of memory, do not lose the error */
+            printStatus(s, tag);
+            return;
+        }
+        sink->capacity = capacity;
+    }
+    sink->items[sink->count] = *s;
+    sink->tags[sink->count] = tag;
+    sink->count++;
+}
+
+/* Move the errors of src to the end of dst, src is left empty */
+void diagMerge(DiagSink *dst, DiagSink *src) {
+    if (src->count == 0) {
+        diagFree(src);
+        return;
+    }
+    if (dst->count + src->count > dst->capacity) {
+        size_t capacity = dst->capacity ? dst->capacity : 16;
+        while (capacity < dst->count + src->count) {
+            capacity *= 2;
+        }
+        Status *items = (Status *)realloc(dst->items, capacity * sizeof(Status));
+        if (items) {
+            dst->items = items;
         }
+        const char **tags = (const char **)realloc(dst->tags, capacity * sizeof(const char *));
+        if (tags) {
+            dst->tags = tags;
+        }
+        if (!items || !tags) { /* Out of memory, do not lose the errors */
+            diagFlush(src);
+            return;
+        }
+        dst->capacity = capacity;
+    }
+    memcpy(dst->items + dst->count, src->items, src->count * sizeof(Status));
+    memcpy(dst->tags + dst->count, src->tags, src->count * sizeof(const char *));
+    dst->count += src->count;
+    free(src->items);
+    free(src->tags);
+    *src = (DiagSink){0};
+}
+
+/* Print every collected error, in the order they were reported
+    stderr is unbuffered, so the lines are gathered first and written at once
+*/
+void diagPrintAll(const DiagSink *sink) {
+    char chunk[4096];
+    size_t len = 0;
+    for (size_t i = 0; i < sink->count; i++) {
+        char line[384];
+        size_t line_len = formatStatusLine(&sink->items[i], sink->tags[i], line, sizeof(line));
+        if (len + line_len >= sizeof(chunk)) {
+            fwrite(chunk, 1, len, stderr);
+            len = 0;
+        }
+        memcpy(chunk + len, line, line_len);
+        len += line_len;
     }
-}
\ No newline at end of file
+    fwrite(chunk, 1, len, stderr);
+}
+
+/* Print the collected errors and empty the sink */
+void diagFlush(DiagSink *sink) {
+    diagPrintAll(sink);
+    diagFree(sink);
+}
+
+void diagFree(DiagSink *sink) {
+    free(sink->items);
+    free(sink->tags);
+    *sink = (DiagSink){0};
+}
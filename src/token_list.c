@@ -1,12 +1,24 @@
 #include "token_list.h"
 #include <stdio.h>
+#include <string.h>
 
 void tokenListInit(TokenList *tl) {
     initHead(&tl->list);
+    tl->arena = NULL;
+}
+
+void tokenListInitArena(TokenList *tl, Arena *arena) {
+    initHead(&tl->list);
+    tl->arena = arena;
+}
+
+/* Copy a token name with the allocator of the list */
+const char *tokenListDup(TokenList *tl, const char *name) {
+    return tl->arena ? arenaStrdup(tl->arena, name) : strdup(name);
 }
 
 void tokenListPushBack(TokenList *tl, Token tok) {
-    TokenNode *n = (TokenNode *)malloc(sizeof(*n));
+    TokenNode *n = (TokenNode *)(tl->arena ? arenaAlloc(tl->arena, sizeof(*n)) : malloc(sizeof(*n)));
     n->tok = tok;
     sllPushBack(&tl->list, &n->link);
 }
@@ -20,6 +32,10 @@ void printAllTokens(TokenList *tl) {
 }
 /* Dealloc the token list (Also clears up .name, which is populated using strdup)*/
 void deallocTokenList(TokenList *tl) {
+    if (tl->arena) { /* Released with the arena */
+        initHead(&tl->list);
+        return;
+    }
     SllNode *curr = tl->list.head;
     while (curr) {
         SllNode *next = curr->next;
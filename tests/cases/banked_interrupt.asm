@@ -0,0 +1,17 @@
+; Address 1 is the interrupt vector: the handler is copied into both banks, at the same addresses
+JMP main
+#isr
+INPUTP %4, !d6
+CALL count
+RETE
+#main
+INTE
+CALL far
+#end
+JMP end
+#far
+OUTPUTP %1, !d1
+RET
+#count
+ADD %5, !d1
+RET
@@ -0,0 +1,12 @@
+; The handler returns from a section placed in bank 1, no bank could enter it from the vector
+JMP main
+#isr
+INPUTP %4, !d6
+JMP far
+#main
+INTE
+#end
+JMP end
+#far
+OUTPUTP %4, !d1
+RETE
@@ -0,0 +1,7 @@
+ADD %1, %13
+ADD %1, !d5
+JMP jump
+ADD %2, %2
+#jump
+SUB %2 , !b10100010
+INTE
@@ -0,0 +1,8 @@
+JMP start
+#tbl DW !d1, !d2, 0
+#tbl2 DW !b1010, !d65535
+#blob INCBIN "data.bin"
+#start CALL tbl2
+JMP blob
+#end
+JMP end
@@ -0,0 +1,7 @@
+# Binary files of the INCBIN cases: 2 words, an odd number of bytes, 200 words and more words than a ROM bank holds
+file(WRITE "${WORK_DIR}/data.bin" "ABCD")
+file(WRITE "${WORK_DIR}/odd.bin" "ABC")
+string(REPEAT "ab" 200 half)
+file(WRITE "${WORK_DIR}/half.bin" "${half}")
+string(REPEAT "ab" 300 big)
+file(WRITE "${WORK_DIR}/big.bin" "${big}")
@@ -0,0 +1,6 @@
+LOAD %1, !d1
+INCBIN "odd.bin"
+INCBIN "missing.bin"
+INCBIN "big.bin"
+#end
+JMP end
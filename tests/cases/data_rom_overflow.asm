@@ -0,0 +1,5 @@
+LOAD %1, !d1
+#a INCBIN "half.bin"
+#b INCBIN "half.bin"
+#end
+JMP end
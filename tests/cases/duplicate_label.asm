@@ -0,0 +1,4 @@
+#loop
+ADD %1, !d1
+#loop
+JMP loop
@@ -0,0 +1,14 @@
+; The handler value %v.t must not share a register with %v.a or %v.b, which are live whenever the interrupt arrives
+JMP main
+#isr
+LOAD %v.t, !d9
+OUTPUTP %v.t, !d3
+RETE
+#main
+LOAD %v.a, !d1
+LOAD %v.b, !d2
+INTE
+#loop
+ADD %v.a, %v.b
+OUTPUTP %v.a, !d1
+JMP loop
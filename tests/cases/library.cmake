@@ -0,0 +1,2 @@
+# The library is copied next to the program so the map holds its path as given
+file(COPY "${CMAKE_CURRENT_LIST_DIR}/library_uart.asm" DESTINATION "${WORK_DIR}")
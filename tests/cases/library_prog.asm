@@ -0,0 +1,9 @@
+; Sends one byte, only the UART routines it reaches are kept from the library
+; Address 1 is the interrupt vector (-I 1), it leads to the UART handler
+JMP start
+JMP uart_isr
+#start
+LOAD %1, !d65
+CALL uart_tx
+#end
+JMP end
@@ -0,0 +1,23 @@
+; uart_tx runs into uart_wait, uart_rx is never used, the vector leads to uart_isr but never to spi_isr
+#uart_tx
+OUTPUTP %1, !d2
+LOAD %2, !d1
+OUTPUTP %2, !d3
+#uart_wait
+INPUTP %3, !d4
+AND %3, !d1
+JZ uart_wait
+RET
+#uart_rx
+INPUTP %3, !d4
+JZ uart_rx
+INPUTP %1, !d5
+RET
+#uart_isr
+INPUTP %4, !d6
+OUTPUTP %4, !d7
+RETE
+#spi_isr
+INPUTP %4, !d8
+OUTPUTP %4, !d9
+RETE
@@ -0,0 +1,3 @@
+# 70000 empty lines followed by a bad immediate, past what 16 bit line numbers hold
+string(REPEAT "\n" 70000 blank)
+file(WRITE "${WORK_DIR}/long.asm" "${blank}LOAD %1, !d300\n")
@@ -0,0 +1,12 @@
+# 1200 labels, one per instruction pair, chained by branches across 12 banks of 100 labels
+set(source "")
+foreach(i RANGE 1199)
+    math(EXPR next "(${i} + 1) % 1200")
+    string(APPEND source "#l${i}\nADD %1, !d1\nJNZ l${next}\n")
+endforeach()
+file(WRITE "${WORK_DIR}/big.asm" "${source}")
+set(script "")
+foreach(bank RANGE 1 11)
+    string(APPEND script "BANK ${bank} l${bank}00\n")
+endforeach()
+file(WRITE "${WORK_DIR}/big.ld" "${script}")
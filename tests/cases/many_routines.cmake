@@ -0,0 +1,7 @@
+# A library of 200 one word routines with short names, the program calls one of them
+set(lib "")
+foreach(i RANGE 199)
+    string(APPEND lib "#r${i}\nRET\n")
+endforeach()
+file(WRITE "${WORK_DIR}/lib.asm" "${lib}")
+file(WRITE "${WORK_DIR}/prog.asm" "CALL r1\n#end\nJMP end\n")
@@ -0,0 +1,8 @@
+LOAD %1, !d1
+LOAD %2, !d300
+ADD %1, %2
+LOAD %20, !d1
+#
+OUTPUTP %1, !b111111111
+#end
+JMP end
@@ -0,0 +1,9 @@
+; Main module: calls the exported routines of obj_math.asm and a local one
+LOAD %1, !d5
+CALL mul2
+CALL local
+#end
+JMP end
+#local
+CALL add3
+RET
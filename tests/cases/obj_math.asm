@@ -0,0 +1,9 @@
+; Math module: two exported routines and a local label
+##mul2
+SL0 %1
+RET
+##add3
+ADD %1, !d3
+JZ done
+#done
+RET
@@ -0,0 +1,10 @@
+# Both modules are assembled into objects with -c, the case links them
+foreach(module main math)
+    execute_process(COMMAND "${ASSEMBLER}" -c -i "${CMAKE_CURRENT_LIST_DIR}/obj_${module}.asm" -o ${module}.o
+        WORKING_DIRECTORY "${WORK_DIR}"
+        OUTPUT_VARIABLE obj_out
+        ERROR_VARIABLE obj_err)
+    if(NOT EXISTS "${WORK_DIR}/${module}.o" OR "${obj_out}${obj_err}" MATCHES "ERROR")
+        message(FATAL_ERROR "Assembling obj_${module}.asm with -c failed:\n${obj_out}${obj_err}")
+    endif()
+endforeach()
@@ -0,0 +1,18 @@
+; The same three instructions appear three times, -Os turns them into one routine called from each place
+LOAD %1, !d10
+#loop
+ADD %2, %1
+SL0 %2
+OUTPUTP %2, !d1
+SUB %1, !d1
+JZ done
+ADD %2, %1
+SL0 %2
+OUTPUTP %2, !d1
+JMP loop
+#done
+ADD %2, %1
+SL0 %2
+OUTPUTP %2, !d1
+#end
+JMP end
@@ -0,0 +1,4 @@
+# out.txt links to real.txt, readable by its owner and group only
+file(WRITE "${WORK_DIR}/real.txt" "old contents\n")
+execute_process(COMMAND chmod 640 real.txt WORKING_DIRECTORY "${WORK_DIR}")
+file(CREATE_LINK real.txt "${WORK_DIR}/out.txt" SYMBOLIC)
@@ -0,0 +1,8 @@
+# The link is kept and the file it points at keeps its mode
+if(NOT IS_SYMLINK "${WORK_DIR}/out.txt")
+    message(FATAL_ERROR "out.txt was replaced by a regular file")
+endif()
+execute_process(COMMAND find real.txt -perm 640 WORKING_DIRECTORY "${WORK_DIR}" OUTPUT_VARIABLE same_mode)
+if(NOT same_mode MATCHES "real.txt")
+    message(FATAL_ERROR "real.txt lost its 0640 mode")
+endif()
@@ -0,0 +1,14 @@
+; A counter kept across a call to a routine which only writes its own value, and a copy which disappears
+LOAD %v.count, !d10
+#loop
+LOAD %v.shown, %v.count
+CALL show
+SUB %v.count, !d1
+JNZ loop
+#end
+JMP end
+#show
+LOAD %v.bits, %v.shown
+SL0 %v.bits
+OUTPUTP %v.bits, !d1
+RET
@@ -0,0 +1,15 @@
+# Answers of serve.jsonl come in completion order, every one is found by its id
+set(answers
+    [[{"id":1,"ok":true,"words":2,"outputs":{"vhdlhex":" \\"0\\" => x\\"0101\\",\\n \\"1\\" => x\\"8101\\",\\n"},"diagnostics":\[\]}]]
+    [[{"id":2,"ok":false,"words":0,"outputs":{},"diagnostics":\[{"tag":"REQUEST",[^}]*"message":"Bad request: malformed object"}\]}]]
+    [[{"id":3,"ok":false,"words":0,"outputs":{},"diagnostics":\[{"tag":"TOKEN","code":4,"line":1,"col":3,"message":"Bad decimal immediate[^}]*}\]}]])
+foreach(answer IN LISTS answers)
+    if(NOT out MATCHES "${answer}\n")
+        message(FATAL_ERROR "No answer matching ${answer}:\n${out}")
+    endif()
+endforeach()
+string(REGEX MATCHALL "\n" lines "${out}")
+list(LENGTH lines count)
+if(NOT count EQUAL 3)
+    message(FATAL_ERROR "Expected 3 answers, got ${count} lines:\n${out}")
+endif()
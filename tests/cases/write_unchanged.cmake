@@ -0,0 +1,4 @@
+# out.txt already holds the output of basic.asm, dated 2001
+execute_process(COMMAND "${ASSEMBLER}" -i "${CMAKE_CURRENT_LIST_DIR}/basic.asm" -o out.txt -f vhdlhex
+    WORKING_DIRECTORY "${WORK_DIR}" OUTPUT_QUIET ERROR_QUIET)
+execute_process(COMMAND touch -t 200101010000 out.txt WORKING_DIRECTORY "${WORK_DIR}")
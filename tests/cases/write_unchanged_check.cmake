@@ -0,0 +1,5 @@
+# With -u the identical output is not written again, out.txt keeps its date
+file(TIMESTAMP "${WORK_DIR}/out.txt" year "%Y" UTC)
+if(NOT year STREQUAL "2001")
+    message(FATAL_ERROR "out.txt was rewritten although its contents did not change (modified in ${year})")
+endif()
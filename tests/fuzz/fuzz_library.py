@@ -0,0 +1,72 @@
+"""Random programs linked against a stripped library must do what they do with the whole library appended
+
+    python3 fuzz_library.py --assembler <pico-assembler> [--seeds N] [--first S] [--work DIR]
+
+The libraries are chains of routines calling, jumping into and falling through into later ones, some returning
+conditionally and some ending in data. The program calls a few of them; the same source is assembled once with the
+library given with -l and once with the library pasted after the program, where nothing is stripped.
+"""
+import os
+import random
+
+import picosim
+
+
+def routine(rnd, i, count):
+    lines = [f'#r{i}']
+    has_entry = False
+    for _ in range(rnd.randint(1, 5)):
+        k = rnd.random()
+        if k < 0.3 and i + 1 < count:
+            lines.append(f'CALL r{rnd.randint(i + 1, count - 1)}')
+        elif k < 0.4 and i + 1 < count:
+            later = rnd.randint(i + 1, count - 1)
+            lines.append(f'JZ r{later}_in' if rnd.random() < 0.5 else f'CALLNZ r{later}')
+        elif k < 0.5 and not has_entry:
+            lines.append(f'#r{i}_in')
+            lines.append(f'ADD %{rnd.randint(1, 4)}, !d{rnd.randint(1, 9)}')
+            has_entry = True
+        else:
+            lines.append(f"{rnd.choice(['ADD', 'XOR', 'SUB', 'OR'])} %{rnd.randint(1, 4)}, !d{rnd.randint(0, 200)}")
+        lines.append(f'OUTPUTP %{rnd.randint(1, 4)}, !d{i}')
+    if not has_entry:
+        lines.insert(2, f'#r{i}_in')
+    # Most routines return, some return conditionally first, and some run into the next one
+    lines += rnd.choice([['RET']] * 4 + [['RETZ', 'RET'], ['ADD %1, !d1']])
+    return lines
+
+
+def generate(seed):
+    rnd = random.Random(seed)
+    count = rnd.randint(4, 25)
+    library = []
+    for i in range(count):
+        library += routine(rnd, i, count)
+    if rnd.random() < 0.3:
+        library += ['#tbl', 'DW !d1, !d2']
+    program = [f'LOAD %{r}, !d{rnd.randint(0, 99)}' for r in range(1, 5)]
+    for _ in range(rnd.randint(1, 4)):
+        program += [f'CALL r{rnd.randint(0, count - 1)}', 'OUTPUTP %1, !d99']
+    program += ['#halt', 'JMP halt']
+    return '\n'.join(program) + '\n', '\n'.join(library) + '\n'
+
+
+def check(assembler, seed, work):
+    program, library = generate(seed)
+    for name, text in (('prog.asm', program), ('lib.asm', library), ('full.asm', program + library)):
+        with open(os.path.join(work, name), 'w') as f:
+            f.write(text)
+    picosim.assemble(assembler, ['-i', 'prog.asm', '-l', 'lib.asm', '-M', 'lib.map', '-o', 'stripped.txt', '-f', 'vhdlhex'], work)
+    picosim.assemble(assembler, ['-i', 'full.asm', '-o', 'full.txt', '-f', 'vhdlhex'], work)
+    stripped = picosim.load(os.path.join(work, 'stripped.txt'))
+    full = picosim.load(os.path.join(work, 'full.txt'))
+    if len(stripped) > len(full):
+        return f'stripping grew the program from {len(full)} to {len(stripped)} words'
+    expected, got = picosim.run(full), picosim.run(stripped)
+    if expected != got:
+        return f'the stripped program does something else:\n  {expected[:12]}\n  {got[:12]}'
+    return None
+
+
+if __name__ == '__main__':
+    picosim.fuzz('Random programs linked against a stripped library must do what they do with the whole library', check)
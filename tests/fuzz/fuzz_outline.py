@@ -0,0 +1,74 @@
+"""Random programs assembled with and without -Os must do the same
+
+    python3 fuzz_outline.py --assembler <pico-assembler> [--seeds N] [--first S] [--work DIR]
+
+The programs are built from a few repeated snippets of register operations mixed with labels, conditional jumps and
+calls to two subroutines returning conditionally, so the outliner finds sequences to share around all of them.
+"""
+import os
+import random
+
+import picosim
+
+
+def instruction(rnd):
+    reg = lambda: rnd.randint(0, 5)
+    k = rnd.random()
+    if k < 0.5:
+        return f"{rnd.choice(['LOAD', 'ADD', 'SUB', 'XOR', 'AND', 'OR', 'ADDCY', 'SUBCY'])} %{reg()}, !d{rnd.randint(0, 255)}"
+    if k < 0.7:
+        return f"{rnd.choice(['LOAD', 'ADD', 'SUB', 'XOR'])} %{reg()}, %{reg()}"
+    if k < 0.85:
+        return f"{rnd.choice(['SL0', 'SR0', 'RL', 'RR', 'SLA', 'SRX'])} %{reg()}"
+    return f"OUTPUTP %{reg()}, !d{rnd.randint(0, 9)}"
+
+
+def generate(seed):
+    rnd = random.Random(seed)
+    snippets = [[instruction(rnd) for _ in range(rnd.randint(2, 6))] for _ in range(6)]
+    routines = ['s0', 's1']
+    lines = []
+    labels = 0
+    for _ in range(rnd.randint(20, 60)):
+        k = rnd.random()
+        if k < 0.45:
+            lines += rnd.choice(snippets)
+        elif k < 0.6:
+            lines.append(instruction(rnd))
+        elif k < 0.7:
+            lines.append(f'#l{labels}')
+            labels += 1
+        elif k < 0.8:
+            lines.append(f"{rnd.choice(['JZ', 'JNZ', 'JC', 'JNC', 'JMP'])} l{labels + rnd.randint(0, 2)}")
+        elif k < 0.9:
+            lines.append(f"{rnd.choice(['CALL', 'CALLZ', 'CALLNC'])} {rnd.choice(routines)}")
+        else:
+            lines.append('OUTPUTP %1, !d9')
+    lines += [f'#l{label}' for label in range(labels, labels + 3)]
+    lines += ['OUTPUTP %0, !d0', '#end', 'JMP end']
+    for name in routines:
+        lines.append(f'#{name}')
+        lines += rnd.choice(snippets)
+        lines.append(rnd.choice(['RETZ', 'RETC']))
+        lines += rnd.choice(snippets)
+        lines.append('RET')
+    return '\n'.join(lines) + '\n'
+
+
+def check(assembler, seed, work):
+    with open(os.path.join(work, 'outline.asm'), 'w') as f:
+        f.write(generate(seed))
+    picosim.assemble(assembler, ['-i', 'outline.asm', '-o', 'plain.txt', '-f', 'vhdlhex'], work)
+    picosim.assemble(assembler, ['-Os', '-i', 'outline.asm', '-o', 'small.txt', '-f', 'vhdlhex'], work)
+    plain = picosim.load(os.path.join(work, 'plain.txt'))
+    small = picosim.load(os.path.join(work, 'small.txt'))
+    if len(small) > len(plain):
+        return f'-Os grew the program from {len(plain)} to {len(small)} words'
+    expected, got = picosim.run(plain), picosim.run(small)
+    if expected != got:
+        return f'-Os changed what the program does:\n  {expected[:12]}\n  {got[:12]}'
+    return None
+
+
+if __name__ == '__main__':
+    picosim.fuzz('Random programs assembled with and without -Os must do the same', check)
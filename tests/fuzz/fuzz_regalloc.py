@@ -0,0 +1,195 @@
+"""Random programs with virtual registers must do what their source says
+
+    python3 fuzz_regalloc.py --assembler <pico-assembler> [--seeds N] [--first S] [--work DIR]
+
+The source is interpreted with every virtual register kept apart, and compared with the simulated image the assembler
+made of it. The programs mix values live across the whole program with short lived ones, physical registers, branches
+and calls to routines writing some of the values. Every other program has an interrupt handler with virtual registers
+of its own (some in a routine it calls) which is raised every few instructions in both runs. The handler writes to its
+own ports and its outputs do not depend on when it runs, so the main outputs must match exactly and the handler
+outputs as a set. Programs needing more registers than there are are skipped.
+"""
+import os
+import random
+import re
+
+import picosim
+
+HANDLER_PORT = 200
+
+
+def generate(seed):
+    rnd = random.Random(seed)
+    values = [f'%v.g{i}' for i in range(rnd.randint(1, 4))]
+    physical = ['%14', '%15']
+    lines = []
+
+    def block(prefix, temp_count, allow_call, port_base=0):
+        temps = [f'%v.{prefix}t{i}' for i in range(temp_count)]
+        inside = temps if port_base else temps + values
+        readable = inside if port_base else inside + physical
+        b = [f'LOAD {t}, !d{rnd.randint(0, 255)}' for t in temps]
+        for _ in range(rnd.randint(3, 12)):
+            if not inside:
+                break
+            k = rnd.random()
+            a = rnd.choice(inside)
+            if k < 0.35:
+                b.append(f"{rnd.choice(['ADD', 'SUB', 'XOR', 'AND', 'OR'])} {a}, {rnd.choice(readable)}")
+            elif k < 0.5:
+                b.append(f'LOAD {a}, {rnd.choice(readable)}')
+            elif k < 0.6:
+                b.append(f"{rnd.choice(['SL0', 'SR0', 'RL'])} {a}")
+            elif k < 0.75:
+                b.append(f'OUTPUTP {rnd.choice(readable)}, !d{port_base + rnd.randint(0, 9)}')
+            elif k < 0.85 and allow_call:
+                b.append(f'CALL r{rnd.randint(0, 1)}')
+            elif k < 0.9:
+                b.append(f'ADD {a}, !d{rnd.randint(1, 9)}')
+                b.append(f'JZ b{prefix}end')
+            else:
+                copy = f'%v.{prefix}c{len(b)}'
+                b.append(f'LOAD {copy}, {rnd.choice(readable)}')
+                b.append(f'OUTPUTP {copy}, !d{port_base + 5}')
+        b.append(f'#b{prefix}end')
+        b += [f'OUTPUTP {t}, !d{port_base + 8}' for t in temps]
+        return b
+
+    interrupts = rnd.random() < 0.5
+    if interrupts:
+        # The handler sits right after the first jump, so it is entered at address 1 before and after allocation
+        lines += ['JMP main', '#isr']
+        lines += block('h', rnd.randint(1, 3), False, HANDLER_PORT)
+        with_routine = rnd.random() < 0.5
+        if with_routine:
+            lines.append('CALL hsub')
+        lines.append(rnd.choice(['RETE', 'RETE', 'RETD']) if not with_routine else 'RETE')
+        if with_routine:
+            lines.append('#hsub')
+            lines += block('s', rnd.randint(1, 2), False, HANDLER_PORT + 10)
+            lines.append('RET')
+        lines += ['#main', 'INTE']
+    lines += [f'LOAD {v}, !d{rnd.randint(0, 255)}' for v in values]
+    lines.append('LOAD %14, !d7')
+    block_count = rnd.randint(3, 10)
+    for i in range(block_count):
+        lines.append(f'#blk{i}')
+        lines += block(f'b{i}', rnd.randint(1, 5), True)
+        if rnd.random() < 0.3:
+            lines.append(f'JNC blk{rnd.randint(i + 1, block_count)}')
+    lines.append(f'#blk{block_count}')
+    lines += [f'OUTPUTP {v}, !d9' for v in values]
+    lines += ['#end', 'JMP end']
+    for r in range(2):
+        lines.append(f'#r{r}')
+        lines += block(f'r{r}', rnd.randint(0, 3), False)
+        lines.append('RET')
+    return '\n'.join(lines) + '\n', interrupts
+
+
+def parse(text):
+    instructions, labels = [], {}
+    for line in text.splitlines():
+        line = line.split(';')[0].strip()
+        if not line:
+            continue
+        if line.startswith('#'):
+            labels[line[1:]] = len(instructions)
+            continue
+        instructions.append(re.split(r'[ ,\t]+', line))
+    return instructions, labels
+
+
+def immediate(operand):
+    return int(operand[2:], 2 if operand.startswith('!b') else 10)
+
+
+def interpret(text, steps=100000, interrupt=None):
+    """Run the source with a register per name, physical or virtual, returns the recorded events"""
+    instructions, labels = parse(text)
+    m = picosim.Machine((labels['isr'], interrupt) if interrupt else None)
+    regs = {}
+    read = lambda operand: regs.get(operand, 0) if operand.startswith('%') else immediate(operand)
+    pc = 0
+    while m.steps < steps:
+        m.steps += 1
+        pc = m.maybe_interrupt(pc)
+        if pc is None:
+            break
+        if pc >= len(instructions):
+            m.events.append(('fell',))
+            break
+        p = instructions[pc]
+        op = p[0]
+        pc += 1
+        if op in picosim.ALU:
+            regs[p[1]], m.c, sets_z = picosim.alu(op, read(p[1]), read(p[2]), m.c)
+            if sets_z:
+                m.z = int(regs[p[1]] == 0)
+        elif op in picosim.SHIFT_RIGHT.values() or op in picosim.SHIFT_LEFT.values():
+            regs[p[1]], m.c = picosim.shift(op, read(p[1]), m.c)
+            m.z = int(regs[p[1]] == 0)
+        elif op == 'OUTPUTP':
+            m.events.append(('out', immediate(p[2]), read(p[1])))
+        elif op == 'OUTPUT':
+            m.events.append(('out', read(p[2]), read(p[1])))
+        elif op in ('INPUT', 'INPUTP'):
+            regs[p[1]] = 0x5A
+        elif op in ('INTE', 'INTD'):
+            m.enabled = op == 'INTE'
+        elif op in ('RETE', 'RETD'):
+            pc = m.return_from_interrupt(op == 'RETE')
+            if pc is None:
+                break
+        elif op.startswith('J'):
+            if m.condition(op[1:] if op != 'JMP' else ''):
+                if labels[p[1]] == pc - 1:
+                    m.events.append(('halt',))
+                    break
+                pc = labels[p[1]]
+        elif op.startswith('CALL'):
+            if m.condition(op[4:]):
+                if not m.push(pc):
+                    break
+                pc = labels[p[1]]
+        elif op.startswith('RET'):
+            if m.condition(op[3:]):
+                entry = m.pop()
+                if entry is None:
+                    break
+                pc = entry
+        else:
+            m.events.append(('bad', op))
+            break
+    return m.events
+
+
+def split(events):
+    """Events of the main program in order, and the set of handler outputs"""
+    main = [e for e in events if e[0] != 'out' or e[1] < HANDLER_PORT]
+    handler = {e for e in events if e[0] == 'out' and e[1] >= HANDLER_PORT}
+    return main, handler
+
+
+def check(assembler, seed, work):
+    text, interrupts = generate(seed)
+    with open(os.path.join(work, 'regalloc.asm'), 'w') as f:
+        f.write(text)
+    try:
+        picosim.assemble(assembler, ['-i', 'regalloc.asm', '-o', 'alloc.txt', '-f', 'vhdlhex'], work)
+    except RuntimeError as e:
+        if 'registers are free' in str(e) or 'No register left' in str(e):
+            raise picosim.Skip()
+        raise
+    period = random.Random(seed).randint(5, 13) if interrupts else None
+    expected = split(interpret(text, interrupt=period))
+    got = split(picosim.run(picosim.load(os.path.join(work, 'alloc.txt')), interrupt=(1, period) if period else None))
+    if expected[0] != got[0]:
+        return f'the allocated program does something else:\n  {expected[0][:12]}\n  {got[0][:12]}'
+    if expected[1] != got[1]:
+        return f'the interrupt handler outputs differ:\n  {sorted(expected[1])}\n  {sorted(got[1])}'
+    return None
+
+
+if __name__ == '__main__':
+    picosim.fuzz('Random programs with virtual registers must do what their source says', check)
@@ -0,0 +1,219 @@
+"""Machine code simulator and driver shared by the random program tests
+
+The simulator runs the words of a vhdlhex image and records what a program does that can be observed from outside:
+the port writes, and how it ends (jump to itself, stack over / underflow, running past the image). Two images doing the
+same thing record the same events, whatever the addresses and registers they use.
+
+Interrupts are raised every `period` instructions executed while they are enabled, so the code they interrupt always
+makes progress. The hardware saves the return
+address and the flags and disables interrupts, RETE / RETD restore the flags and enable / disable them again.
+"""
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+STACK_SIZE = 31
+
+ALU = ['LOAD', 'AND', 'OR', 'XOR', 'ADD', 'ADDCY', 'SUB', 'SUBCY']
+SHIFT_RIGHT = {0xE: 'SR0', 0xF: 'SR1', 0xA: 'SRX', 0x8: 'SRA', 0xC: 'RR'}
+SHIFT_LEFT = {0x6: 'SL0', 0x7: 'SL1', 0x2: 'SLX', 0x0: 'SLA', 0x4: 'RL'}
+
+
+def alu(op, x, b, c):
+    """Result, carry and whether Z is updated of an ALU operation, values are 8 bits wide"""
+    if op == 'LOAD':
+        return b, c, False
+    if op in ('AND', 'OR', 'XOR'):
+        v = {'AND': x & b, 'OR': x | b, 'XOR': x ^ b}[op]
+        return v, 0, True
+    if op in ('ADD', 'ADDCY'):
+        v = x + b + (c if op == 'ADDCY' else 0)
+        return v & 0xFF, int(v > 0xFF), True
+    v = x - b - (c if op == 'SUBCY' else 0)
+    return v & 0xFF, int(v < 0), True
+
+
+def shift(op, x, c):
+    """Result and carry of a shift or rotate"""
+    if op[1] == 'R':
+        fill = {'SR0': 0, 'SR1': 0x80, 'SRX': x & 0x80, 'SRA': c << 7, 'RR': (x & 1) << 7}[op]
+        return (x >> 1) | fill, x & 1
+    fill = {'SL0': 0, 'SL1': 1, 'SLX': x & 1, 'SLA': c, 'RL': x >> 7}[op]
+    return ((x << 1) & 0xFF) | fill, x >> 7
+
+
+class Machine:
+    """Registers, flags and stack shared by the machine code simulator and the source interpreters"""
+
+    def __init__(self, interrupt=None):
+        self.z = 0
+        self.c = 0
+        self.stack = []
+        self.events = []
+        self.enabled = False
+        self.interrupt = interrupt  # (vector, period) or None
+        self.steps = 0
+        self.until_interrupt = interrupt[1] if interrupt else 0
+
+    def condition(self, suffix):
+        return {'': True, 'Z': self.z == 1, 'NZ': self.z == 0, 'C': self.c == 1, 'NC': self.c == 0}[suffix]
+
+    def push(self, entry):
+        self.stack.append(entry)
+        if len(self.stack) > STACK_SIZE:
+            self.events.append(('overflow',))
+            return False
+        return True
+
+    def pop(self):
+        if not self.stack:
+            self.events.append(('underflow',))
+            return None
+        return self.stack.pop()
+
+    def maybe_interrupt(self, pc):
+        """Returns the pc execution continues at"""
+        if not self.interrupt or not self.enabled:
+            return pc
+        self.until_interrupt -= 1
+        if self.until_interrupt > 0:
+            return pc
+        self.until_interrupt = self.interrupt[1]
+        self.enabled = False
+        if not self.push((pc, self.z, self.c)):
+            return None
+        return self.interrupt[0]
+
+    def return_from_interrupt(self, enable):
+        entry = self.pop()
+        if entry is None:
+            return None
+        pc, self.z, self.c = entry if isinstance(entry, tuple) else (entry, self.z, self.c)
+        self.enabled = enable
+        return pc
+
+
+def load(path):
+    """Words of a vhdlhex image"""
+    with open(path) as f:
+        return [int(m.group(1), 16) for m in re.finditer(r'x"([0-9A-Fa-f]{4})"', f.read())]
+
+
+def run(words, steps=100000, interrupt=None):
+    """Run an image from address 0, returns the recorded events"""
+    m = Machine(interrupt)
+    r = [0] * 16
+    pc = 0
+    while m.steps < steps:
+        m.steps += 1
+        pc = m.maybe_interrupt(pc)
+        if pc is None:
+            break
+        if pc >= len(words):
+            m.events.append(('fell',))
+            break
+        w = words[pc]
+        pc += 1
+        top = w >> 12
+        if top <= 7 or top == 0xC:
+            op = ALU[w & 0x7] if top == 0xC else ALU[top]
+            a = (w >> 8) & 0xF
+            b = r[(w >> 4) & 0xF] if top == 0xC else w & 0xFF
+            r[a], m.c, sets_z = alu(op, r[a], b, m.c)
+            if sets_z:
+                m.z = int(r[a] == 0)
+        elif top == 0xD:
+            a = (w >> 8) & 0xF
+            code = w & 0xF
+            op = SHIFT_RIGHT.get(code) or SHIFT_LEFT.get(code)
+            if not op:
+                m.events.append(('bad', w))
+                break
+            r[a], m.c = shift(op, r[a], m.c)
+            m.z = int(r[a] == 0)
+        elif top == 0xE:
+            m.events.append(('out', w & 0xFF, r[(w >> 8) & 0xF]))
+        elif top == 0xF:
+            m.events.append(('out', r[(w >> 4) & 0xF], r[(w >> 8) & 0xF]))
+        elif top in (0xA, 0xB):
+            r[(w >> 8) & 0xF] = 0x5A  # Every input reads the same value
+        elif top in (8, 9) and (w & 0xFFD7) == 0x80D0:  # INTE / INTD / RETE / RETD
+            if w & 0x08:
+                pc = m.return_from_interrupt(bool(w & 0x20))
+                if pc is None:
+                    break
+            else:
+                m.enabled = bool(w & 0x20)
+        elif top in (8, 9):
+            suffix = '' if top == 8 else ['Z', 'NZ', 'C', 'NC'][(w >> 10) & 3]
+            kind = (w >> 8) & 3
+            if kind == 1:  # JMP
+                if m.condition(suffix):
+                    if pc - 1 == (w & 0xFF):
+                        m.events.append(('halt',))
+                        break
+                    pc = w & 0xFF
+            elif kind == 3:  # CALL
+                if m.condition(suffix):
+                    if not m.push(pc):
+                        break
+                    pc = w & 0xFF
+            elif kind == 0 and (w & 0x80):  # RET
+                if m.condition(suffix):
+                    entry = m.pop()
+                    if entry is None:
+                        break
+                    pc = entry
+            else:
+                m.events.append(('bad', w))
+                break
+        else:
+            m.events.append(('bad', w))
+            break
+    return m.events
+
+
+def assemble(assembler, args, cwd):
+    """Run the assembler, returns its console output or raises when it reports an error"""
+    proc = subprocess.run([assembler] + args, cwd=cwd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if proc.returncode != 0 or 'ERROR' in proc.stdout:
+        raise RuntimeError('pico-assembler ' + ' '.join(args) + ' failed:\n' + proc.stdout)
+    return proc.stdout
+
+
+class Skip(Exception):
+    """Raised by a check when the random program can not be used, e.g. it does not fit"""
+
+
+def fuzz(description, check):
+    """Command line of the random program tests: check(assembler, seed, work_dir) returns None or a difference"""
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument('--assembler', required=True, help='pico-assembler executable')
+    parser.add_argument('--seeds', type=int, default=100, help='number of random programs')
+    parser.add_argument('--first', type=int, default=1, help='first seed')
+    parser.add_argument('--work', default='.', help='directory the programs are written to')
+    args = parser.parse_args()
+    os.makedirs(args.work, exist_ok=True)
+    assembler = os.path.abspath(args.assembler)
+    skipped = 0
+    for seed in range(args.first, args.first + args.seeds):
+        try:
+            difference = check(assembler, seed, args.work)
+        except Skip:
+            skipped += 1
+            continue
+        except RuntimeError as e:
+            difference = str(e)
+        if difference:
+            print(f'seed {seed}: {difference}')
+            print(f'rerun with --first {seed} --seeds 1, the program is left in {args.work}')
+            sys.exit(1)
+    print(f'{args.seeds - skipped} random programs behave the same, {skipped} skipped')
+
+
+if __name__ == '__main__':
+    a, b = run(load(sys.argv[1])), run(load(sys.argv[2]))
+    print('same' if a == b else 'DIFFERENT')
+    sys.exit(0 if a == b else 1)
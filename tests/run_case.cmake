@@ -0,0 +1,51 @@
+# Run the assembler for one regression case and check its console output and the files it writes
+#   ASSEMBLER  pico-assembler executable
+#   WORK_DIR   directory the case runs in, emptied first
+#   SETUP      optional script run in WORK_DIR before the assembler, generates large inputs
+#   ARGS       assembler arguments, relative paths are inside WORK_DIR
+#   INPUT      optional file given to the assembler on stdin
+#   MATCH      regular expression the console output must contain
+#   NO_MATCH   regular expression the console output must not contain
+#   OUTPUTS    files written by the assembler, compared byte for byte with the files listed in EXPECTED
+#   CHECK      optional script run in WORK_DIR after the outputs were compared
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+if(SETUP)
+    include("${SETUP}")
+endif()
+
+if(NOT INPUT)
+    set(INPUT /dev/null)
+endif()
+execute_process(COMMAND "${ASSEMBLER}" ${ARGS}
+    WORKING_DIRECTORY "${WORK_DIR}"
+    INPUT_FILE "${INPUT}"
+    OUTPUT_VARIABLE out
+    ERROR_VARIABLE err
+    RESULT_VARIABLE rc)
+set(console "${out}${err}")
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "pico-assembler exited with ${rc}:\n${console}")
+endif()
+if(MATCH AND NOT console MATCHES "${MATCH}")
+    message(FATAL_ERROR "Console output does not match '${MATCH}':\n${console}")
+endif()
+if(NO_MATCH AND console MATCHES "${NO_MATCH}")
+    message(FATAL_ERROR "Console output matches '${NO_MATCH}':\n${console}")
+endif()
+
+list(LENGTH OUTPUTS count)
+if(count GREATER 0)
+    math(EXPR last "${count} - 1")
+    foreach(i RANGE ${last})
+        list(GET OUTPUTS ${i} produced)
+        list(GET EXPECTED ${i} expected)
+        execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${WORK_DIR}/${produced}" "${expected}" RESULT_VARIABLE differ)
+        if(differ)
+            message(FATAL_ERROR "${produced} differs from ${expected}")
+        endif()
+    endforeach()
+endif()
+if(CHECK)
+    include("${CHECK}")
+endif()
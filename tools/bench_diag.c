@@ -0,0 +1,212 @@
+/* Benchmark of the diagnostic path on large clean and large broken sources
+    pico-bench-diag [-n runs]
+   The clean source fills the ROM, the broken ones hold an error on every one of their 60000 lines, found by the lexer
+   or by the parser. Lexing, parsing and linking run in process as in main and stop after the first failing step.
+   Formatting the collected diagnostics is timed apart, since a Status only records the format and its arguments
+*/
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashmap.h"
+#include "instruction.h"
+#include "io.h"
+#include "linker.h"
+#include "parser.h"
+#include "status.h"
+#include "token_list.h"
+
+#define BROKEN_LINES 60000
+
+typedef struct {
+    const char *name;
+    char *text;
+    size_t size;
+    size_t cap;
+} Source;
+
+typedef struct {
+    double assemble; /* Lexing, parsing and linking, in seconds */
+    double format;   /* Formatting every collected diagnostic */
+    size_t errors;
+} RunResult;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void appendLine(Source *src, const char *line) {
+    size_t len = strlen(line);
+    if (src->size + len + 2 > src->cap) {
+        src->cap = 2 * (src->size + len + 2);
+        src->text = (char *)realloc(src->text, src->cap);
+        if (!src->text) {
+            fprintf(stderr, "[pico-bench-diag] Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(src->text + src->size, line, len);
+    src->size += len;
+    src->text[src->size++] = '\n';
+    src->text[src->size] = '\0';
+}
+
+/* A full ROM of valid instructions, branches only go to the first 256 words since ADDR operands are 8 bits wide */
+static Source makeClean(void) {
+    Source src = {.name = "clean"};
+    char line[64];
+    for (unsigned i = 0; i < MAX_PROGRAM_SIZE; i++) {
+        if (i < ROM_SIZE) {
+            snprintf(line, sizeof(line), "#l%u", i);
+            appendLine(&src, line);
+        }
+        switch (i % 4) {
+        case 0:
+            snprintf(line, sizeof(line), "LOAD %%%u, !d%u", i % 16, i % 256);
+            break;
+        case 1:
+            snprintf(line, sizeof(line), "ADD %%%u, %%%u", i % 16, (i + 1) % 16);
+            break;
+        case 2:
+            snprintf(line, sizeof(line), "OUTPUTP %%%u, !b%s", i % 16, "1010");
+            break;
+        default:
+            snprintf(line, sizeof(line), "JNZ l%u", (i * 7) % ROM_SIZE);
+            break;
+        }
+        appendLine(&src, line);
+    }
+    return src;
+}
+
+static Source makeBroken(const char *name, const char *const *lines, size_t line_count) {
+    Source src = {.name = name};
+    for (unsigned i = 0; i < BROKEN_LINES; i++) {
+        appendLine(&src, lines[i % line_count]);
+    }
+    return src;
+}
+
+static void addDefinition(HashMap *map, const char *name, uint16_t mask, ArgumentType type, uint8_t arg1, uint8_t arg2) {
+    insertHashMap(map, name, &(InstructionDefinition){.mask = mask, .arg_type = type, .arg1_start = arg1, .arg2_start = arg2}, sizeof(InstructionDefinition));
+}
+
+static RunResult runOnce(const Source *src, HashMap *inst_map, Instruction *instr_list) {
+    RunResult res = {0};
+    TokenList tl;
+    tokenListInit(&tl);
+    DiagSink diag;
+    diagInit(&diag);
+    HashMap *sym_map = NULL;
+    if (!allocHashMap(&sym_map, HASH_MAP_BUCKETS)) {
+        fprintf(stderr, "[pico-bench-diag] Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(instr_list, 0, (MAX_PROGRAM_SIZE + 1) * sizeof(Instruction));
+
+    double start = now();
+    uint16_t loc = 0;
+    Status ok = readTokensFromBuffer(&tl, src->text, src->size, src->name, &diag, 1);
+    if (ok.code == OK) {
+        ok = parseTokenList(&tl, inst_map, sym_map, instr_list, &loc, &diag);
+    }
+    if (ok.code == OK) {
+        ok = link(instr_list, loc, sym_map, &diag);
+    }
+    res.assemble = now() - start;
+
+    start = now();
+    char buf[256];
+    size_t total = 0;
+    for (size_t i = 0; i < diag.count; i++) {
+        total += formatStatus(&diag.items[i], buf, sizeof(buf));
+    }
+    res.format = now() - start;
+    res.errors = diag.count;
+    if (diag.count > 0 && total == 0) {
+        fprintf(stderr, "[pico-bench-diag] Diagnostics formatted to nothing\n");
+    }
+
+    diagFree(&diag);
+    deallocTokenList(&tl);
+    deallocHashMap(sym_map);
+    return res;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned runs = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n runs]\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    HashMap *inst_map = NULL;
+    Instruction *instr_list = (Instruction *)calloc(MAX_PROGRAM_SIZE + 1, sizeof(Instruction));
+    double *assemble = (double *)calloc(runs, sizeof(double));
+    double *format = (double *)calloc(runs, sizeof(double));
+    if (!instr_list || !assemble || !format || !allocHashMap(&inst_map, HASH_MAP_BUCKETS)) {
+        fprintf(stderr, "[pico-bench-diag] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    /* The instructions used by the sources, with the masks of the assembler's instruction set */
+    addDefinition(inst_map, "LOAD", 0b1100000000000000, REG_ANY, 8, 4);
+    addDefinition(inst_map, "ADD", 0b1100000000000100, REG_ANY, 8, 4);
+    addDefinition(inst_map, "OUTPUTP", 0b1110000000000000, REG_IMM, 8, 0);
+    addDefinition(inst_map, "JNZ", 0b1001010100000000, ADDR, 0, 0);
+
+    static const char *const lex_errors[] = {"ADD %16, !d1", "LOAD %1, !d300", "ADD %1, !x12", "#"};
+    static const char *const parse_errors[] = {"ADD %1", "LOAD !d1, %1", "OUTPUTP %1, %2", "JNZ %1"};
+    Source sources[] = {
+        makeClean(),
+        makeBroken("broken (lexer)", lex_errors, sizeof(lex_errors) / sizeof(lex_errors[0])),
+        makeBroken("broken (parser)", parse_errors, sizeof(parse_errors) / sizeof(parse_errors[0])),
+    };
+
+    printf("Status: %zu bytes, %u runs per source\n", sizeof(Status), runs);
+    printf("%-16s %8s %8s %10s %12s %12s %12s\n", "source", "lines", "KB", "errors", "assemble ms", "format ms", "ns/line");
+    for (size_t s = 0; s < sizeof(sources) / sizeof(sources[0]); s++) {
+        const Source *src = &sources[s];
+        size_t lines = 0;
+        for (size_t i = 0; i < src->size; i++) {
+            lines += src->text[i] == '\n';
+        }
+        size_t errors = 0;
+        for (unsigned r = 0; r < runs; r++) {
+            RunResult res = runOnce(src, inst_map, instr_list);
+            assemble[r] = res.assemble;
+            format[r] = res.format;
+            errors = res.errors;
+        }
+        qsort(assemble, runs, sizeof(double), compareDouble);
+        qsort(format, runs, sizeof(double), compareDouble);
+        double median = assemble[runs / 2];
+        printf("%-16s %8zu %8zu %10zu %12.2f %12.2f %12.1f\n", src->name, lines, src->size / 1024, errors,
+               median * 1e3, format[runs / 2] * 1e3, median * 1e9 / (double)lines);
+        free(src->text);
+    }
+
+    deallocHashMap(inst_map);
+    free(instr_list);
+    free(assemble);
+    free(format);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/* Benchmark of the output formats against the snprintf formatters they replaced
+    pico-bench-format [-n renders] [-c]
+   Every built-in format renders a full ROM image (256 words) with its template and with the old formatter function,
+   kept here unchanged as the baseline, and the time per line of both is printed.
+   -c only checks that the templates produce byte for byte the output of the old formatters, on images of several
+   lengths and on every 16-bit word, and exits with a failure on the first difference
+*/
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "format.h"
+#include "instruction.h"
+
+typedef void (*FormatterFn)(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr);
+
+typedef struct {
+    const char *name;
+    const char *template_src;
+    FormatterFn formatter;
+    FormatTemplate compiled;
+} Format;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* The formatter functions as they were before the templates, line numbers wrap at 256 like the addresses of an image */
+
+static void VHDL_STYLE_HEX(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
+    snprintf(buf, buf_size, " \"%u\" => x\"%04X\",\n", line_number, instr->raw);
+}
+
+static void VHDL_STYLE_BIN(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
+    char binary[17];
+    for (int i = 15; i >= 0; i--) {
+        binary[15 - i] = (instr->raw & (1 << i)) ? '1' : '0';
+    }
+    binary[16] = '\0';
+    snprintf(buf, buf_size, " \"%u\" => b\"%s\",\n", line_number, binary);
+}
+
+static void DEBUG(char *buf, size_t buf_size, uint8_t line_number, const Instruction *instr) {
+    char head[64] = "";
+    char binary[64];
+    if (line_number % 10 == 0) {
+        snprintf(head, sizeof(head), "      FEDC BA98 7654 3210\n");
+    }
+    int pos = 0;
+    for (int i = 15; i >= 0; i--) {
+        binary[pos++] = (instr->raw & (1 << i)) ? '1' : '0';
+        if (i % 4 == 0 && i != 0) {
+            binary[pos++] = ' ';
+        }
+    }
+    binary[pos] = '\0';
+    if (line_number % 10 == 0) {
+        snprintf(buf, buf_size, " %s%.3u => %s\n", head, line_number, binary);
+    } else {
+        snprintf(buf, buf_size, "%.3u => %s\n", line_number, binary);
+    }
+}
+
+/* The image loop of the old writeInstructionsToFile */
+static size_t renderOld(FormatterFn formatter, const Instruction *instr_list, size_t count, char *image) {
+    char line_buf[64];
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        formatter(line_buf, sizeof(line_buf), (uint8_t)i, &instr_list[i]);
+        size_t line_len = strlen(line_buf);
+        memcpy(image + len, line_buf, line_len);
+        len += line_len;
+    }
+    return len;
+}
+
+static size_t renderNew(const FormatTemplate *t, const Instruction *instr_list, size_t count, char *image) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += renderTemplate(t, image + len, (uint16_t)i, instr_list[i].raw);
+    }
+    return len;
+}
+
+static bool sameImage(const Format *f, const Instruction *instr_list, size_t count, char *old_image, char *new_image) {
+    size_t old_len = renderOld(f->formatter, instr_list, count, old_image);
+    size_t new_len = renderNew(&f->compiled, instr_list, count, new_image);
+    if (old_len == new_len && memcmp(old_image, new_image, old_len) == 0) {
+        return true;
+    }
+    size_t at = 0;
+    while (at < old_len && at < new_len && old_image[at] == new_image[at]) {
+        at++;
+    }
+    fprintf(stderr, "[pico-bench-format] %s differs from the old formatter at byte %zu of a %zu word image (%zu / %zu bytes)\n",
+            f->name, at, count, old_len, new_len);
+    return false;
+}
+
+static int checkFormats(Format *formats, size_t format_count, Instruction *instr_list, char *old_image, char *new_image) {
+    static const size_t lengths[] = {1, 6, 10, 11, ROM_SIZE};
+    for (size_t f = 0; f < format_count; f++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            if (!sameImage(&formats[f], instr_list, lengths[l], old_image, new_image)) {
+                return EXIT_FAILURE;
+            }
+        }
+        /* Every word, one image per 256 of them */
+        Instruction words[ROM_SIZE];
+        for (uint32_t base = 0; base <= 0xFFFF; base += ROM_SIZE) {
+            for (uint32_t i = 0; i < ROM_SIZE; i++) {
+                words[i] = (Instruction){.raw = (uint16_t)(base + i)};
+            }
+            if (!sameImage(&formats[f], words, ROM_SIZE, old_image, new_image)) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    printf("Templates match the old formatters byte for byte\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned renders = 20000;
+    bool check_only = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:ch")) != -1) {
+        switch (opt) {
+        case 'n':
+            renders = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            check_only = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n renders] [-c]\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (renders < 1) {
+        renders = 1;
+    }
+
+    Format formats[] = {
+        {.name = "debug", .template_src = FORMAT_DEBUG, .formatter = DEBUG},
+        {.name = "vhdlbin", .template_src = FORMAT_VHDL_BIN, .formatter = VHDL_STYLE_BIN},
+        {.name = "vhdlhex", .template_src = FORMAT_VHDL_HEX, .formatter = VHDL_STYLE_HEX},
+    };
+    size_t format_count = sizeof(formats) / sizeof(formats[0]);
+    for (size_t f = 0; f < format_count; f++) {
+        if (compileTemplate(&formats[f].compiled, formats[f].template_src).code != OK) {
+            fprintf(stderr, "[pico-bench-format] The %s template does not compile\n", formats[f].name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* A pseudo random image, the same on every run */
+    Instruction instr_list[ROM_SIZE];
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < ROM_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        instr_list[i] = (Instruction){.raw = (uint16_t)(seed >> 16)};
+    }
+    char *old_image = (char *)malloc(ROM_SIZE * 64 + 1);
+    char *new_image = (char *)malloc(ROM_SIZE * MAX_FORMAT_TEXT + 1);
+    if (!old_image || !new_image) {
+        fprintf(stderr, "[pico-bench-format] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    int res = checkFormats(formats, format_count, instr_list, old_image, new_image);
+    if (res != EXIT_SUCCESS || check_only) {
+        free(old_image);
+        free(new_image);
+        return res;
+    }
+
+    printf("%u renders of a %u word image\n", renders, ROM_SIZE);
+    printf("%-10s %16s %16s %10s\n", "format", "old ns/line", "template ns/line", "speedup");
+    size_t sink = 0;
+    for (size_t f = 0; f < format_count; f++) {
+        double start = now();
+        for (unsigned r = 0; r < renders; r++) {
+            sink += renderOld(formats[f].formatter, instr_list, ROM_SIZE, old_image);
+        }
+        double old_time = now() - start;
+        start = now();
+        for (unsigned r = 0; r < renders; r++) {
+            sink += renderNew(&formats[f].compiled, instr_list, ROM_SIZE, new_image);
+        }
+        double new_time = now() - start;
+        double lines = (double)renders * ROM_SIZE;
+        printf("%-10s %16.1f %16.1f %9.2fx\n", formats[f].name, old_time * 1e9 / lines, new_time * 1e9 / lines,
+               old_time / new_time);
+    }
+    if (sink == 0) {
+        fprintf(stderr, "[pico-bench-format] Nothing was rendered\n");
+    }
+
+    free(old_image);
+    free(new_image);
+    return EXIT_SUCCESS;
+}
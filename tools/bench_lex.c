@@ -0,0 +1,187 @@
+/* Scaling benchmark of the chunked lexer
+    pico-bench-lex [-n runs] [-l lines]
+   A source of the given number of lines (60000 by default, an error every 97th line) is lexed from memory with
+   1, 2, 4, 8 and 16 threads. The median time and the speedup over one thread are printed for every thread count,
+   and the tokens and the formatted diagnostics are checked to be the same as with one thread
+*/
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "io.h"
+#include "status.h"
+#include "token_list.h"
+
+typedef struct {
+    char *text;
+    size_t size;
+    size_t cap;
+} Source;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void appendLine(Source *src, const char *line) {
+    size_t len = strlen(line);
+    if (src->size + len + 2 > src->cap) {
+        src->cap = 2 * (src->size + len + 2);
+        src->text = (char *)realloc(src->text, src->cap);
+        if (!src->text) {
+            fprintf(stderr, "[pico-bench-lex] Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(src->text + src->size, line, len);
+    src->size += len;
+    src->text[src->size++] = '\n';
+    src->text[src->size] = '\0';
+}
+
+static Source makeSource(unsigned line_count) {
+    Source src = {0};
+    char line[128];
+    for (unsigned i = 0; i < line_count; i++) {
+        if (i % 97 == 96) {
+            snprintf(line, sizeof(line), "LOAD %%%u, !d%u", 16 + i % 4, 256 + i % 100);
+        } else if (i % 16 == 0) {
+            snprintf(line, sizeof(line), "#l%u", i);
+        } else {
+            switch (i % 4) {
+            case 0:
+                snprintf(line, sizeof(line), "LOAD %%%u, !d%u ; counter %u", i % 16, i % 256, i);
+                break;
+            case 1:
+                snprintf(line, sizeof(line), "ADD %%%u, %%%u", i % 16, (i + 1) % 16);
+                break;
+            case 2:
+                snprintf(line, sizeof(line), "OUTPUTP %%%u, !b%s", i % 16, "10100101");
+                break;
+            default:
+                snprintf(line, sizeof(line), "JNZ l%u", i & ~15u);
+                break;
+            }
+        }
+        appendLine(&src, line);
+    }
+    return src;
+}
+
+typedef struct {
+    TokenList tl;
+    DiagSink diag;
+} LexResult;
+
+static double lexOnce(const Source *src, unsigned threads, LexResult *res) {
+    tokenListInit(&res->tl);
+    diagInit(&res->diag);
+    double start = now();
+    readTokensFromBuffer(&res->tl, src->text, src->size, "bench.asm", &res->diag, threads);
+    return now() - start;
+}
+
+static void freeResult(LexResult *res) {
+    deallocTokenList(&res->tl);
+    diagFree(&res->diag);
+}
+
+/* Tokens and formatted diagnostics must not depend on the thread count */
+static bool sameResult(const LexResult *a, const LexResult *b) {
+    const SllNode *x = a->tl.list.head;
+    const SllNode *y = b->tl.list.head;
+    while (x && y) {
+        const Token *tx = &((const TokenNode *)x)->tok;
+        const Token *ty = &((const TokenNode *)y)->tok;
+        if (tx->type != ty->type || tx->value != ty->value || tx->line != ty->line || tx->col != ty->col ||
+            strcmp(tx->name, ty->name) != 0) {
+            return false;
+        }
+        x = x->next;
+        y = y->next;
+    }
+    if (x || y || a->diag.count != b->diag.count) {
+        return false;
+    }
+    char buf_a[256];
+    char buf_b[256];
+    for (size_t i = 0; i < a->diag.count; i++) {
+        formatStatus(&a->diag.items[i], buf_a, sizeof(buf_a));
+        formatStatus(&b->diag.items[i], buf_b, sizeof(buf_b));
+        if (strcmp(buf_a, buf_b) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned runs = 15;
+    unsigned line_count = 60000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            line_count = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n runs] [-l lines]\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    Source src = makeSource(line_count);
+    double *times = (double *)calloc(runs, sizeof(double));
+    if (!times) {
+        fprintf(stderr, "[pico-bench-lex] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    LexResult serial;
+    lexOnce(&src, 1, &serial);
+    printf("%u lines, %zu KB, %zu diagnostics, %u processors, %u runs per thread count\n", line_count, src.size / 1024,
+           serial.diag.count, getCpuCount(), runs);
+    printf("%-8s %12s %10s %8s\n", "threads", "median ms", "MB/s", "speedup");
+
+    static const unsigned thread_counts[] = {1, 2, 4, 8, 16};
+    double serial_median = 0;
+    int status = EXIT_SUCCESS;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        unsigned threads = thread_counts[t];
+        for (unsigned r = 0; r < runs; r++) {
+            LexResult res;
+            times[r] = lexOnce(&src, threads, &res);
+            if (r == 0 && !sameResult(&serial, &res)) {
+                fprintf(stderr, "[pico-bench-lex] Tokens or diagnostics differ with %u threads\n", threads);
+                status = EXIT_FAILURE;
+            }
+            freeResult(&res);
+        }
+        qsort(times, runs, sizeof(double), compareDouble);
+        double median = times[runs / 2];
+        if (threads == 1) {
+            serial_median = median;
+        }
+        printf("%-8u %12.2f %10.1f %7.2fx\n", threads, median * 1e3, (double)src.size / median / 1e6,
+               serial_median / median);
+    }
+
+    freeResult(&serial);
+    free(times);
+    free(src.text);
+    return status;
+}
@@ -0,0 +1,258 @@
+/* Load test for the resident assembler (--serve) against one process per file
+    pico-loadtest -i <source> [-s <socket>] [-b <assembler>] [-c <clients>] [-n <requests>] [-f <format>]
+   Every client sends its share of the requests one after the other and times each of them.
+   With -s the requests go to a running server, with -b every request starts the assembler on the source file
+*/
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+typedef struct {
+    const char *socket_path;
+    const char *assembler;
+    const char *source_path;
+    const char *format;
+    const char *source_json; /* Source text escaped as a JSON string, quotes included */
+    unsigned requests;
+    double *latencies;
+    unsigned failures;
+    pthread_t thread;
+} Client;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *readSource(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *text = size >= 0 ? (char *)malloc((size_t)size + 1) : NULL;
+    if (text) {
+        text[fread(text, 1, (size_t)size, fp)] = '\0';
+    }
+    fclose(fp);
+    return text;
+}
+
+static char *jsonQuote(const char *s) {
+    char *out = (char *)malloc(6 * strlen(s) + 3);
+    if (!out) {
+        return NULL;
+    }
+    char *o = out;
+    *o++ = '"';
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            *o++ = '\\';
+            *o++ = (char)c;
+        } else if (c == '\n') {
+            *o++ = '\\';
+            *o++ = 'n';
+        } else if (c < 0x20) {
+            o += sprintf(o, "\\u%04x", c);
+        } else {
+            *o++ = (char)c;
+        }
+    }
+    *o++ = '"';
+    *o = '\0';
+    return out;
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* Read one answer line, returns whether the server reported success */
+static bool readAnswer(int fd, char **buf, size_t *cap) {
+    size_t len = 0;
+    for (;;) {
+        if (len + 1 >= *cap) {
+            *cap = *cap ? 2 * *cap : 64 * 1024;
+            *buf = (char *)realloc(*buf, *cap);
+            if (!*buf) {
+                return false;
+            }
+        }
+        ssize_t n = read(fd, *buf + len, *cap - len - 1);
+        if (n <= 0) {
+            return false;
+        }
+        len += (size_t)n;
+        if ((*buf)[len - 1] == '\n') {
+            break;
+        }
+    }
+    (*buf)[len] = '\0';
+    return strstr(*buf, "\"ok\":true") != NULL;
+}
+
+static void *serverClient(void *arg) {
+    Client *c = (Client *)arg;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", c->socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("[pico-loadtest] connect");
+        c->failures = c->requests;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    size_t req_cap = strlen(c->source_json) + strlen(c->format) + 64;
+    char *request = (char *)malloc(req_cap);
+    char *answer = NULL;
+    size_t answer_cap = 0;
+    for (unsigned i = 0; request && i < c->requests; i++) {
+        int len = snprintf(request, req_cap, "{\"id\":%u,\"source\":%s,\"formats\":[\"%s\"]}\n", i, c->source_json, c->format);
+        double start = now();
+        bool ok = writeAll(fd, request, (size_t)len) && readAnswer(fd, &answer, &answer_cap);
+        c->latencies[i] = now() - start;
+        c->failures += !ok;
+    }
+    free(request);
+    free(answer);
+    close(fd);
+    return NULL;
+}
+
+static void *processClient(void *arg) {
+    Client *c = (Client *)arg;
+    char *argv[] = {(char *)c->assembler, "-i", (char *)c->source_path, "-o", "/dev/null", "-f", (char *)c->format, "-j", "1", NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    for (unsigned i = 0; i < c->requests; i++) {
+        double start = now();
+        pid_t pid;
+        int status = 0;
+        bool ok = posix_spawn(&pid, c->assembler, &actions, NULL, argv, environ) == 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status);
+        c->latencies[i] = now() - start;
+        c->failures += !ok;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    return NULL;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Run the clients, then print the latency percentiles and the throughput */
+static void runLoad(const char *name, Client *clients, unsigned client_count, unsigned requests, void *(*fn)(void *)) {
+    double *latencies = (double *)malloc(requests * sizeof(double));
+    if (!latencies) {
+        return;
+    }
+    unsigned offset = 0;
+    double start = now();
+    for (unsigned i = 0; i < client_count; i++) {
+        clients[i].requests = requests / client_count + (i < requests % client_count);
+        clients[i].latencies = latencies + offset;
+        clients[i].failures = 0;
+        offset += clients[i].requests;
+        pthread_create(&clients[i].thread, NULL, fn, &clients[i]);
+    }
+    unsigned failures = 0;
+    for (unsigned i = 0; i < client_count; i++) {
+        pthread_join(clients[i].thread, NULL);
+        failures += clients[i].failures;
+    }
+    double elapsed = now() - start;
+    qsort(latencies, requests, sizeof(double), compareDouble);
+    printf("[%s] %u requests, %u clients: p50 %.3f ms, p99 %.3f ms, %.0f req/s, %u failed\n", name, requests, client_count,
+           latencies[requests / 2] * 1e3, latencies[(size_t)(requests * 0.99)] * 1e3, requests / elapsed, failures);
+    free(latencies);
+}
+
+int main(int argc, char *argv[]) {
+    Client base = {.format = "vhdlhex"};
+    unsigned client_count = 4;
+    unsigned requests = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:s:b:c:n:f:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            base.source_path = optarg;
+            break;
+        case 's':
+            base.socket_path = optarg;
+            break;
+        case 'b':
+            base.assembler = optarg;
+            break;
+        case 'c':
+            client_count = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            requests = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            base.format = optarg;
+            break;
+        default:
+            fprintf(stderr, "[pico-loadtest] Usage: %s -i <source> [-s <socket>] [-b <assembler>] [-c <clients>] [-n <requests>] [-f <format>]\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (!base.source_path || (!base.socket_path && !base.assembler) || client_count == 0 || requests == 0) {
+        fprintf(stderr, "[pico-loadtest] A source (-i) and a server socket (-s) or an assembler (-b) are required\n");
+        return EXIT_FAILURE;
+    }
+    char *source = readSource(base.source_path);
+    base.source_json = source ? jsonQuote(source) : NULL;
+    if (!base.source_json) {
+        fprintf(stderr, "[pico-loadtest] Could not read %s\n", base.source_path);
+        return EXIT_FAILURE;
+    }
+    if (client_count > requests) {
+        client_count = requests;
+    }
+    Client *clients = (Client *)malloc(client_count * sizeof(Client));
+    for (unsigned i = 0; clients && i < client_count; i++) {
+        clients[i] = base;
+    }
+    if (clients && base.socket_path) {
+        runLoad("SERVER", clients, client_count, requests, serverClient);
+    }
+    if (clients && base.assembler) {
+        runLoad("PROCESS PER FILE", clients, client_count, requests, processClient);
+    }
+    free(clients);
+    free((void *)base.source_json);
+    free(source);
+    return EXIT_SUCCESS;
+}